@@ -39,63 +39,169 @@
 
 
 #include "qmirclientbackingstore.h"
+#include "qmirclientbackingstorecompositor.h"
 #include "qmirclientlogging.h"
-#include <QtGui/QOffscreenSurface>
+#include "qmirclientwindow.h"
+#include <QElapsedTimer>
+#include <QtGui/QOpenGLBuffer>
 #include <QtGui/QOpenGLContext>
 #include <QtGui/QOpenGLTexture>
-#include <QtGui/QMatrix4x4>
-#include <QtGui/private/qopengltextureblitter_p.h>
 #include <QtGui/qopenglfunctions.h>
 
+#include <cstring>
+
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+
+namespace {
+
+// Whether sub-rectangles of an image can be uploaded straight from it, see updateTexture()
+bool hasUnpackRowLength()
+{
+    static int supported = -1;
+    if (Q_UNLIKELY(supported == -1)) {
+        auto context = QOpenGLContext::currentContext();
+        supported = !context->isOpenGLES() || context->format().majorVersion() >= 3
+                || context->hasExtension("GL_EXT_unpack_subimage");
+        qCDebug(mirclientGraphics, "Backing store sub-image uploads: %s", supported ? "yes" : "no");
+    }
+    return supported;
+}
+
+// Whether to upload through pixel unpack buffers rather than straight from client memory
+bool useStreamingUploads()
+{
+    static int enabled = -1;
+    if (Q_UNLIKELY(enabled == -1)) {
+        auto context = QOpenGLContext::currentContext();
+        enabled = qgetenv("QTUBUNTU_BACKINGSTORE_UPLOAD") == "pbo"
+                && (!context->isOpenGLES() || context->format().majorVersion() >= 3);
+        qCDebug(mirclientGraphics, "Backing store streaming uploads: %s", enabled ? "yes" : "no");
+    }
+    return enabled;
+}
+
+/*
+ * Without GL_UNPACK_ROW_LENGTH, a dirty rectangle can either be widened to full rows, which are
+ * contiguous in the image, or be copied out of the image first. Which one is cheaper depends on
+ * how fast the driver uploads compared to how fast memory is copied, so both are measured as
+ * the application runs.
+ */
+class UploadCostModel
+{
+public:
+    bool shouldWiden(const QRect &rect, int imageWidth) const
+    {
+        const qreal widenCost = mUploadNsPerByte * imageWidth * rect.height();
+        const qreal copyCost = (mCopyNsPerByte + mUploadNsPerByte) * rect.width() * rect.height();
+        return widenCost <= copyCost;
+    }
+
+    void recordUpload(qint64 bytes, qint64 ns) { record(&mUploadNsPerByte, bytes, ns); }
+    void recordCopy(qint64 bytes, qint64 ns) { record(&mCopyNsPerByte, bytes, ns); }
+
+private:
+    static void record(qreal *nsPerByte, qint64 bytes, qint64 ns)
+    {
+        // Timer resolution makes small transfers meaningless
+        if (bytes < 16 * 1024) {
+            return;
+        }
+        *nsPerByte += (qreal(ns) / bytes - *nsPerByte) / 8;
+    }
+
+    // Equal costs to begin with, which widens rectangles spanning at least half the image
+    qreal mUploadNsPerByte{1.0};
+    qreal mCopyNsPerByte{1.0};
+};
+
+UploadCostModel uploadCostModel;
+
+// Image and texture sizes of growing windows are rounded up to multiples of this, so that an
+// interactive resize doesn't need a new allocation for every step
+const int capacityGranularity = 128;
+
+// How long the window size has to stay the same before excess capacity is given back
+const int shrinkDelayMs = 1000;
+
+QSize capacityFor(const QSize &size)
+{
+    auto roundUp = [](int value) {
+        return qMax(1, (value + capacityGranularity - 1) / capacityGranularity) * capacityGranularity;
+    };
+    return QSize(roundUp(size.width()), roundUp(size.height()));
+}
+
+} // anonymous namespace
+
 QMirClientBackingStore::QMirClientBackingStore(QWindow* window)
     : QPlatformBackingStore(window)
-    , mContext(new QOpenGLContext)
+    // Backing stores share a context and blitter, each one only needs its own texture
+    , mCompositor(QMirClientBackingStoreCompositor::forFormat(window->requestedFormat(), window->screen()))
     , mTexture(new QOpenGLTexture(QOpenGLTexture::Target2D))
-    , mBlitter(new QOpenGLTextureBlitter)
 {
-    mContext->setFormat(window->requestedFormat());
-    mContext->setScreen(window->screen());
-    mContext->create();
-
     window->setSurfaceType(QSurface::OpenGLSurface);
+
+    mShrinkTimer.setSingleShot(true);
+    mShrinkTimer.setInterval(shrinkDelayMs);
+    QObject::connect(&mShrinkTimer, &QTimer::timeout, [this]() { shrinkCapacity(); });
 }
 
 QMirClientBackingStore::~QMirClientBackingStore()
 {
-    if (!mTexture->isCreated())
+    if (!mTexture->isCreated() && !mUploadBuffers[0])
         return;
 
     // Paraphrasing QOpenGLCompositorBackingStore: "With render-to-texture-widgets QWidget makes
     // sure the context is made current before destroying backingstores. That is however not the
     // case for windows with regular widgets only."
-    auto context = QOpenGLContext::currentContext();
-    if (!context) { // QWindow's backing QPlatformSurface probably gone, use temp one for cleanup
-        QOffscreenSurface tempSurface;
-        tempSurface.setFormat(mContext->format());
-        tempSurface.create();
-        mContext->makeCurrent(&tempSurface);
-    }
-    // QOpenGLTexture will go out of scope, is then deleted. Then QOpenGLContext falls out of
-    // scope, calls doneCurrent and is then deleted.
+    // The texture belongs to the shared context, whose window may well be gone, so make sure
+    // that context is current while deleting it.
+    {
+        QMirClientBackingStoreCompositor::CleanupScope cleanup(mCompositor.data());
+        mTexture.reset();
+        for (auto &buffer : mUploadBuffers) {
+            buffer.reset();
+        }
+    }
+    // The compositor is released after this, and deleted along with the context if this was its
+    // last backing store.
 }
 
 void QMirClientBackingStore::flush(QWindow* window, const QRegion& region, const QPoint& offset)
 {
-    Q_UNUSED(region);
     Q_UNUSED(offset);
-    mContext->makeCurrent(window);
+    mCompositor->makeCurrent(window);
     glViewport(0, 0, window->width(), window->height());
 
     updateTexture();
 
-    if (!mBlitter->isCreated())
-        mBlitter->create();
+    // The back buffer still holds the frame presented bufferAge frames ago, so besides the
+    // flushed region, whatever the frames since then changed needs repairing. Unknown ages
+    // mean unknown contents.
+    const QRect windowRect(QPoint(), window->size());
+    const int age = mCompositor->bufferAge(window);
+    QRegion repair = region & windowRect;
+    if (age > 0 && age <= mFlushHistory.count() + 1) {
+        for (int i = 0; i < age - 1; ++i) {
+            repair |= mFlushHistory.at(i);
+        }
+    } else {
+        repair = windowRect;
+    }
+
+    mFlushHistory.prepend(region & windowRect);
+    if (mFlushHistory.count() > MaxBufferAge) {
+        mFlushHistory.removeLast();
+    }
 
-    mBlitter->bind();
-    mBlitter->blit(mTexture->textureId(), QMatrix4x4(), QOpenGLTextureBlitter::OriginTopLeft);
-    mBlitter->release();
+    // The texture may be larger than the window, only its top left corner is in use
+    mCompositor->blit(mTexture->textureId(), mImage.rect(), mCapacityImage.size(), repair, window->height());
 
-    mContext->swapBuffers(window);
+    // Only the flushed region changed since the last frame
+    static_cast<QMirClientWindow *>(window->handle())->setSwapDamage(region);
+    mCompositor->context()->swapBuffers(window);
 }
 
 void QMirClientBackingStore::updateTexture()
@@ -107,36 +213,70 @@ void QMirClientBackingStore::updateTexture()
         mTexture->setMinificationFilter(QOpenGLTexture::Nearest);
         mTexture->setMagnificationFilter(QOpenGLTexture::Nearest);
         mTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
-        mTexture->setData(mImage, QOpenGLTexture::DontGenerateMipMaps);
+        mTexture->setData(mCapacityImage, QOpenGLTexture::DontGenerateMipMaps);
         mTexture->create();
     }
     mTexture->bind();
 
-    QRegion fixed;
+    if (useStreamingUploads() && streamTexture()) {
+        mDirty = QRegion();
+        return;
+    }
+
     QRect imageRect = mImage.rect();
 
+    if (hasUnpackRowLength()) {
+        // GL skips the rest of each row itself, so every rectangle comes straight from the image
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, mImage.bytesPerLine() / 4);
+        for (const QRect &rect : mDirty.rects()) {
+            const QRect r = imageRect & rect;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r.x(), r.y(), r.width(), r.height(), GL_RGBA, GL_UNSIGNED_BYTE,
+                            mImage.constScanLine(r.y()) + r.x() * 4);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+        mDirty = QRegion();
+        return;
+    }
+
+    QRegion fixed;
+
+    // Rows of the image are as long as the rows of the texture, which may be wider than the window
+    const int rowWidth = mImage.bytesPerLine() / 4;
+
     for (const QRect &rect : mDirty.rects()) {
         // intersect with image rect to be sure
         QRect r = imageRect & rect;
 
         // if the rect is wide enough it is cheaper to just extend it instead of doing an image copy
-        if (r.width() >= imageRect.width() / 2) {
+        if (uploadCostModel.shouldWiden(r, rowWidth)) {
             r.setX(0);
-            r.setWidth(imageRect.width());
+            r.setWidth(rowWidth);
         }
 
         fixed |= r;
     }
 
+    QElapsedTimer timer;
     for (const QRect &rect : fixed.rects()) {
+        const qint64 bytes = qint64(rect.width()) * rect.height() * 4;
+
         // if the sub-rect is full-width we can pass the image data directly to
         // OpenGL instead of copying, since there is no gap between scanlines
-        if (rect.width() == imageRect.width()) {
+        if (rect.width() == rowWidth) {
+            timer.start();
             glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rect.y(), rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE,
                             mImage.constScanLine(rect.y()));
+            uploadCostModel.recordUpload(bytes, timer.nsecsElapsed());
         } else {
+            timer.start();
+            const QImage subImage = mImage.copy(rect);
+            uploadCostModel.recordCopy(bytes, timer.nsecsElapsed());
+
+            timer.start();
             glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE,
-                            mImage.copy(rect).constBits());
+                            subImage.constBits());
+            uploadCostModel.recordUpload(bytes, timer.nsecsElapsed());
         }
     }
     /* End of code taken from QEGLPlatformBackingStore */
@@ -145,6 +285,70 @@ void QMirClientBackingStore::updateTexture()
 }
 
 
+bool QMirClientBackingStore::streamTexture()
+{
+    const QRect imageRect = mImage.rect();
+    const QVector<QRect> rects = mDirty.rects();
+
+    int bytes = 0;
+    for (const QRect &rect : rects) {
+        const QRect r = imageRect & rect;
+        bytes += r.width() * r.height() * 4;
+    }
+    if (bytes == 0) {
+        return true;
+    }
+
+    auto &buffer = mUploadBuffers[mUploadBufferIndex];
+    if (!buffer) {
+        buffer.reset(new QOpenGLBuffer(QOpenGLBuffer::PixelUnpackBuffer));
+        buffer->setUsagePattern(QOpenGLBuffer::StreamDraw);
+        if (!buffer->create()) {
+            buffer.reset();
+            return false;
+        }
+    }
+
+    buffer->bind();
+    if (buffer->size() < bytes) {
+        buffer->allocate(bytes);
+    }
+
+    // Invalidating tells the driver the old contents are not needed, so mapping doesn't wait for
+    // a transfer still reading from them
+    auto data = static_cast<uchar *>(buffer->mapRange(0, bytes, QOpenGLBuffer::RangeWrite
+                                                                | QOpenGLBuffer::RangeInvalidateBuffer));
+    if (!data) {
+        buffer->release();
+        return false;
+    }
+
+    // Pack the rectangles one after the other, each with rows as wide as the rectangle
+    int offset = 0;
+    for (const QRect &rect : rects) {
+        const QRect r = imageRect & rect;
+        const int rowBytes = r.width() * 4;
+        for (int y = r.top(); y <= r.bottom(); ++y) {
+            memcpy(data + offset, mImage.constScanLine(y) + r.x() * 4, rowBytes);
+            offset += rowBytes;
+        }
+    }
+    buffer->unmap();
+
+    // The transfers from the buffer to the texture happen asynchronously
+    offset = 0;
+    for (const QRect &rect : rects) {
+        const QRect r = imageRect & rect;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r.x(), r.y(), r.width(), r.height(), GL_RGBA, GL_UNSIGNED_BYTE,
+                        reinterpret_cast<const void *>(static_cast<quintptr>(offset)));
+        offset += r.width() * r.height() * 4;
+    }
+    buffer->release();
+
+    mUploadBufferIndex = (mUploadBufferIndex + 1) % UploadBufferCount;
+    return true;
+}
+
 void QMirClientBackingStore::beginPaint(const QRegion& region)
 {
     mDirty |= region;
@@ -152,14 +356,61 @@ void QMirClientBackingStore::beginPaint(const QRegion& region)
 
 void QMirClientBackingStore::resize(const QSize& size, const QRegion& /*staticContents*/)
 {
-    mImage = QImage(size, QImage::Format_RGBA8888);
+    if (mCapacityImage.isNull()) {
+        // Most windows never resize, so no room to spare to begin with
+        allocateCapacity(size);
+    } else if (size.width() > mCapacityImage.width() || size.height() > mCapacityImage.height()) {
+        // Leave room for a resize in progress to carry on growing, and give back the excess once
+        // the size settles
+        allocateCapacity(capacityFor(size * 1.25));
+        mShrinkTimer.start();
+    } else if (mShrinkTimer.isActive()
+               || size.width() * size.height() * 2 < mCapacityImage.width() * mCapacityImage.height()) {
+        // Still resizing, or most of the capacity went unused
+        mShrinkTimer.start();
+    }
+
+    // Paint straight into the top left corner of the larger image
+    mImage = QImage(mCapacityImage.bits(), size.width(), size.height(), mCapacityImage.bytesPerLine(),
+                    QImage::Format_RGBA8888);
+
+    // The buffers get the new size too, their old contents don't matter anymore
+    mFlushHistory.clear();
+}
+
+void QMirClientBackingStore::allocateCapacity(const QSize &capacity)
+{
+    qCDebug(mirclientGraphics, "Backing store of window %p allocating (%dx%d)px",
+            window(), capacity.width(), capacity.height());
+
+    mCapacityImage = QImage(capacity, QImage::Format_RGBA8888);
 
-    mContext->makeCurrent(window());
+    mCompositor->makeCurrent(window());
 
     if (mTexture->isCreated())
         mTexture->destroy();
 }
 
+void QMirClientBackingStore::shrinkCapacity()
+{
+    const QSize capacity = mImage.size();
+    if (capacity == mCapacityImage.size() || mImage.isNull()) {
+        return;
+    }
+
+    // Nothing repaints the window for this, so keep its contents
+    const QImage contents = mImage.copy();
+    allocateCapacity(capacity);
+    mImage = QImage(mCapacityImage.bits(), contents.width(), contents.height(), mCapacityImage.bytesPerLine(),
+                    QImage::Format_RGBA8888);
+    for (int y = 0; y < contents.height(); ++y) {
+        memcpy(mImage.scanLine(y), contents.constScanLine(y), contents.bytesPerLine());
+    }
+
+    // The texture is created again on the next flush
+    mDirty = mImage.rect();
+}
+
 QPaintDevice* QMirClientBackingStore::paintDevice()
 {
     return &mImage;
@@ -167,6 +418,7 @@ QPaintDevice* QMirClientBackingStore::paintDevice()
 
 QImage QMirClientBackingStore::toImage() const
 {
-    // used by QPlatformBackingStore::composeAndFlush
+    // used by QPlatformBackingStore::composeAndFlush. mImage doesn't own its pixels, which only
+    // live as long as the current capacity.
     return mImage;
 }
@@ -42,10 +42,13 @@
 #define QMIRCLIENTBACKINGSTORE_H
 
 #include <qpa/qplatformbackingstore.h>
+#include <QSharedPointer>
+#include <QTimer>
+#include <QVector>
 
-class QOpenGLContext;
+class QMirClientBackingStoreCompositor;
+class QOpenGLBuffer;
 class QOpenGLTexture;
-class QOpenGLTextureBlitter;
 
 class QMirClientBackingStore : public QPlatformBackingStore
 {
@@ -62,13 +65,27 @@ public:
 
 protected:
     void updateTexture();
+    bool streamTexture();
+    void allocateCapacity(const QSize &capacity);
+    void shrinkCapacity();
 
 private:
-    QScopedPointer<QOpenGLContext> mContext;
+    QSharedPointer<QMirClientBackingStoreCompositor> mCompositor;
     QScopedPointer<QOpenGLTexture> mTexture;
-    QScopedPointer<QOpenGLTextureBlitter> mBlitter;
-    QImage mImage;
+    QImage mCapacityImage; // owns the pixels, the texture has the same size
+    QImage mImage; // the part of mCapacityImage matching the window size
     QRegion mDirty;
+    QTimer mShrinkTimer;
+
+    // Regions flushed by the most recent frames, newest first, for repairing older buffers
+    enum { MaxBufferAge = 3 };
+    QVector<QRegion> mFlushHistory;
+
+    // Pixel unpack buffers used in turn, so that filling one doesn't wait for the driver to be
+    // done transferring the previous frame from the other
+    enum { UploadBufferCount = 2 };
+    QScopedPointer<QOpenGLBuffer> mUploadBuffers[UploadBufferCount];
+    int mUploadBufferIndex{0};
 };
 
 #endif // QMIRCLIENTBACKINGSTORE_H
@@ -0,0 +1,181 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientbackingstorecompositor.h"
+#include "qmirclientglcontext.h"
+#include "qmirclientlogging.h"
+
+#include <QPair>
+#include <QVector>
+#include <QWeakPointer>
+#include <QtGui/QMatrix4x4>
+#include <QtGui/QOffscreenSurface>
+#include <QtGui/QOpenGLContext>
+#include <QtGui/QRegion>
+#include <QtGui/QWindow>
+#include <QtGui/private/qopengltextureblitter_p.h>
+#include <QtGui/qopenglfunctions.h>
+
+namespace
+{
+
+const int MaxScissoredBlits = 8;
+
+// Few distinct formats are ever requested, linear lookup is fine
+QVector<QPair<QSurfaceFormat, QWeakPointer<QMirClientBackingStoreCompositor>>> compositors;
+
+} // namespace
+
+QSharedPointer<QMirClientBackingStoreCompositor> QMirClientBackingStoreCompositor::forFormat(
+        const QSurfaceFormat &format, QScreen *screen)
+{
+    for (int i = compositors.count() - 1; i >= 0; --i) {
+        auto compositor = compositors.at(i).second.toStrongRef();
+        if (!compositor) {
+            compositors.remove(i);
+        } else if (compositors.at(i).first == format) {
+            return compositor;
+        }
+    }
+
+    QSharedPointer<QMirClientBackingStoreCompositor> compositor(new QMirClientBackingStoreCompositor(format, screen));
+    compositors.append(qMakePair(format, compositor.toWeakRef()));
+    return compositor;
+}
+
+QMirClientBackingStoreCompositor::QMirClientBackingStoreCompositor(const QSurfaceFormat &format, QScreen *screen)
+    : mContext(new QOpenGLContext)
+    , mBlitter(new QOpenGLTextureBlitter)
+{
+    qCDebug(mirclientGraphics) << "Creating backing store compositor for format" << format;
+
+    mContext->setFormat(format);
+    mContext->setScreen(screen);
+    mContext->create();
+}
+
+QMirClientBackingStoreCompositor::~QMirClientBackingStoreCompositor()
+{
+    if (!mBlitter->isCreated()) {
+        return;
+    }
+
+    // The blitter's program belongs to the context, so release it while the context is current
+    CleanupScope cleanup(this);
+    mBlitter->destroy();
+}
+
+bool QMirClientBackingStoreCompositor::makeCurrent(QWindow *window)
+{
+    return mContext->makeCurrent(window);
+}
+
+QMirClientBackingStoreCompositor::CleanupScope::CleanupScope(QMirClientBackingStoreCompositor *compositor)
+    : mCompositor(compositor)
+    , mPreviousContext(QOpenGLContext::currentContext())
+    , mPreviousSurface(mPreviousContext ? mPreviousContext->surface() : nullptr)
+{
+    if (mPreviousContext == mCompositor->mContext.data()) {
+        return;
+    }
+
+    // Kept around, as it needs no buffer when EGL supports surfaceless contexts
+    if (!mCompositor->mCleanupSurface) {
+        mCompositor->mCleanupSurface.reset(new QOffscreenSurface);
+        mCompositor->mCleanupSurface->setFormat(mCompositor->mContext->format());
+        mCompositor->mCleanupSurface->create();
+    }
+    mCompositor->mContext->makeCurrent(mCompositor->mCleanupSurface.data());
+}
+
+QMirClientBackingStoreCompositor::CleanupScope::~CleanupScope()
+{
+    // Whoever is destroying the backing store may be in the middle of its own GL work,
+    // e.g. with a QOpenGLWidget, so give it its context back
+    if (mPreviousContext == mCompositor->mContext.data()) {
+        return;
+    } else if (mPreviousContext) {
+        mPreviousContext->makeCurrent(mPreviousSurface);
+    } else {
+        mCompositor->mContext->doneCurrent();
+    }
+}
+
+int QMirClientBackingStoreCompositor::bufferAge(QWindow *window) const
+{
+    auto context = static_cast<QMirClientOpenGLContext *>(mContext->handle());
+    return context->bufferAge(window->handle());
+}
+
+void QMirClientBackingStoreCompositor::blit(GLuint textureId, const QRect &source, const QSize &textureSize,
+                                            const QRegion &region, int windowHeight)
+{
+    // The program is only compiled once, for the first window flushed
+    if (!mBlitter->isCreated())
+        mBlitter->create();
+
+    mBlitter->bind();
+
+    const QMatrix3x3 sourceTransform = QOpenGLTextureBlitter::sourceTransform(source, textureSize,
+                                                                              QOpenGLTextureBlitter::OriginTopLeft);
+
+    // Each blit covers the whole viewport, the scissor limits it to one rectangle. Past a few
+    // rectangles, one blit of their bounding rectangle is cheaper.
+    if (region.isEmpty()) {
+        mBlitter->blit(textureId, QMatrix4x4(), sourceTransform);
+    } else {
+        auto scissoredBlit = [&](const QRect &rect) {
+            glScissor(rect.x(), windowHeight - rect.y() - rect.height(), rect.width(), rect.height());
+            mBlitter->blit(textureId, QMatrix4x4(), sourceTransform);
+        };
+
+        glEnable(GL_SCISSOR_TEST);
+        if (region.rectCount() > MaxScissoredBlits) {
+            scissoredBlit(region.boundingRect());
+        } else {
+            for (const QRect &rect : region.rects()) {
+                scissoredBlit(rect);
+            }
+        }
+        glDisable(GL_SCISSOR_TEST);
+    }
+
+    mBlitter->release();
+}
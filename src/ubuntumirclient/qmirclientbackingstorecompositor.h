@@ -0,0 +1,106 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMIRCLIENTBACKINGSTORECOMPOSITOR_H
+#define QMIRCLIENTBACKINGSTORECOMPOSITOR_H
+
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QSurfaceFormat>
+#include <QtGui/qopengl.h>
+
+class QOffscreenSurface;
+class QRect;
+class QRegion;
+class QSize;
+class QOpenGLContext;
+class QOpenGLTextureBlitter;
+class QScreen;
+class QSurface;
+class QWindow;
+
+/*
+ * QMirClientBackingStoreCompositor - the GL context and texture blitter shared by all the
+ * backing stores requesting the same surface format. Each backing store only owns the texture
+ * holding its window's contents, so that a new widget window doesn't cost a context and a
+ * shader compilation. Used from the GUI thread only.
+ */
+class QMirClientBackingStoreCompositor
+{
+public:
+    // Shared with every other backing store asking for the same format while any is alive
+    static QSharedPointer<QMirClientBackingStoreCompositor> forFormat(const QSurfaceFormat &format, QScreen *screen);
+
+    ~QMirClientBackingStoreCompositor();
+
+    QOpenGLContext *context() const { return mContext.data(); }
+
+    bool makeCurrent(QWindow *window);
+
+    // Makes the context current, on an offscreen surface if need be, for cleaning up GL resources,
+    // and makes whatever context was current before current again once it goes out of scope
+    class CleanupScope
+    {
+    public:
+        explicit CleanupScope(QMirClientBackingStoreCompositor *compositor);
+        ~CleanupScope();
+
+    private:
+        QMirClientBackingStoreCompositor * const mCompositor;
+        QOpenGLContext * const mPreviousContext;
+        QSurface * const mPreviousSurface;
+    };
+
+    // Draws the source rectangle of the texture over the whole viewport of the current window,
+    // limited to the given region (in window coordinates) if not empty
+    void blit(GLuint textureId, const QRect &source, const QSize &textureSize, const QRegion &region,
+              int windowHeight);
+    // Age of the back buffer of the window the context is current on, see QMirClientOpenGLContext
+    int bufferAge(QWindow *window) const;
+
+private:
+    QMirClientBackingStoreCompositor(const QSurfaceFormat &format, QScreen *screen);
+
+    QScopedPointer<QOpenGLContext> mContext;
+    QScopedPointer<QOpenGLTextureBlitter> mBlitter;
+    QScopedPointer<QOffscreenSurface> mCleanupSurface;
+};
+
+#endif // QMIRCLIENTBACKINGSTORECOMPOSITOR_H
@@ -40,6 +40,7 @@
 
 #include "qmirclientclipboard.h"
 #include "qmirclientlogging.h"
+#include "qmirclientnativeinterface.h"
 #include "qmirclientwindow.h"
 
 #include <QDBusPendingCallWatcher>
@@ -68,6 +69,14 @@ QMirClientClipboard::QMirClientClipboard()
     connect(qGuiApp, &QGuiApplication::applicationStateChanged,
         this, &QMirClientClipboard::onApplicationStateChanged);
 
+    // Content-hub identifies applications by the persistent id of their focused window, which
+    // windows only get some time after being created
+    connect(static_cast<QMirClientNativeInterface*>(QGuiApplication::platformNativeInterface()),
+            &QMirClientNativeInterface::windowPropertyChanged,
+            this, &QMirClientClipboard::onWindowPropertyChanged);
+    connect(qGuiApp, &QGuiApplication::focusWindowChanged,
+            this, &QMirClientClipboard::retryPendingSync);
+
     requestMimeData();
 }
 
@@ -98,19 +107,38 @@ void QMirClientClipboard::setMimeData(QMimeData* mimeData, QClipboard::Mode mode
 {
     QWindow *focusWindow = QGuiApplication::focusWindow();
     if (focusWindow && mode == QClipboard::Clipboard && mimeData != nullptr) {
-        QString surfaceId = static_cast<QMirClientWindow*>(focusWindow->handle())->persistentSurfaceId();
+        mMimeData = mimeData;
+        mSyncPending = false; // our paste is the latest one
 
-        QDBusPendingCall reply = mContentHub->createPaste(surfaceId, *mimeData);
+        if (sharePaste()) {
+            mClipboardState = SyncedClipboard;
+        } else {
+            qCDebug(mirclient, "setMimeData: persistent id of the focused window not known yet, sharing the clipboard later");
+            mClipboardState = UnsharedClipboard;
+        }
+        emitChanged(QClipboard::Clipboard);
+    }
+}
 
-        // Don't care whether it succeeded
-        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(reply, this);
-        connect(watcher, &QDBusPendingCallWatcher::finished,
-                watcher, &QObject::deleteLater);
+bool QMirClientClipboard::sharePaste()
+{
+    QWindow *focusWindow = QGuiApplication::focusWindow();
+    if (!focusWindow) {
+        return false;
+    }
 
-        mMimeData = mimeData;
-        mClipboardState = SyncedClipboard;
-        emitChanged(QClipboard::Clipboard);
+    QString surfaceId = static_cast<QMirClientWindow*>(focusWindow->handle())->persistentSurfaceId();
+    if (surfaceId.isEmpty()) {
+        return false;
     }
+
+    QDBusPendingCall reply = mContentHub->createPaste(surfaceId, *mMimeData);
+
+    // Don't care whether it succeeded
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(reply, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished,
+            watcher, &QObject::deleteLater);
+    return true;
 }
 
 bool QMirClientClipboard::supportsMode(QClipboard::Mode mode) const
@@ -134,6 +162,25 @@ void QMirClientClipboard::onApplicationStateChanged(Qt::ApplicationState state)
     }
 }
 
+void QMirClientClipboard::onWindowPropertyChanged(QPlatformWindow *window, const QString &name)
+{
+    QWindow *focusWindow = QGuiApplication::focusWindow();
+    if (name == QStringLiteral("persistentSurfaceId") && focusWindow && focusWindow->handle() == window) {
+        retryPendingSync();
+    }
+}
+
+void QMirClientClipboard::retryPendingSync()
+{
+    if (mClipboardState == UnsharedClipboard) {
+        if (sharePaste()) {
+            mClipboardState = SyncedClipboard;
+        }
+    } else if (mSyncPending) {
+        requestMimeData();
+    }
+}
+
 void QMirClientClipboard::updateMimeData()
 {
     if (qGuiApp->applicationState() != Qt::ApplicationActive) {
@@ -143,8 +190,14 @@ void QMirClientClipboard::updateMimeData()
 
     QWindow *focusWindow = QGuiApplication::focusWindow();
     if (focusWindow) {
-        delete mMimeData;
         QString surfaceId = static_cast<QMirClientWindow*>(focusWindow->handle())->persistentSurfaceId();
+        if (surfaceId.isEmpty()) {
+            // window not fully created yet, leave the clipboard outdated until it is
+            mSyncPending = true;
+            return;
+        }
+        mSyncPending = false;
+        delete mMimeData;
         mMimeData = mContentHub->latestPaste(surfaceId);
         mClipboardState = SyncedClipboard;
         emitChanged(QClipboard::Clipboard);
@@ -153,6 +206,11 @@ void QMirClientClipboard::updateMimeData()
 
 void QMirClientClipboard::requestMimeData()
 {
+    if (mClipboardState == UnsharedClipboard || mClipboardState == SyncingClipboard) {
+        // Our paste is newer than whatever content-hub has, or the latest one is on its way
+        return;
+    }
+
     if (qGuiApp->applicationState() != Qt::ApplicationActive) {
         // Don't even bother asking as content-hub would probably ignore our request (and should).
         return;
@@ -164,6 +222,11 @@ void QMirClientClipboard::requestMimeData()
     }
 
     QString surfaceId = static_cast<QMirClientWindow*>(focusWindow->handle())->persistentSurfaceId();
+    if (surfaceId.isEmpty()) {
+        mSyncPending = true; // window not fully created yet
+        return;
+    }
+    mSyncPending = false;
     QDBusPendingCall reply = mContentHub->requestLatestPaste(surfaceId);
     mClipboardState = SyncingClipboard;
 
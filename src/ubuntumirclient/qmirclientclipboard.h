@@ -55,6 +55,7 @@ namespace com {
 }
 
 class QDBusPendingCallWatcher;
+class QPlatformWindow;
 
 class QMirClientClipboard : public QObject, public QPlatformClipboard
 {
@@ -71,19 +72,27 @@ public:
 
 private Q_SLOTS:
     void onApplicationStateChanged(Qt::ApplicationState state);
+    void onWindowPropertyChanged(QPlatformWindow *window, const QString &name);
+    void retryPendingSync();
 
 private:
     void updateMimeData();
     void requestMimeData();
+    bool sharePaste();
 
     QMimeData *mMimeData;
 
     enum {
         OutdatedClipboard, // Our mimeData is outdated, need to fetch latest from ContentHub
         SyncingClipboard, // Our mimeData is outdated and we are waiting for ContentHub to reply with the latest paste
-        SyncedClipboard // Our mimeData is in sync with what ContentHub has
+        SyncedClipboard, // Our mimeData is in sync with what ContentHub has
+        UnsharedClipboard // Our mimeData is newer than what ContentHub has, it is shared once the
+                          // persistent id of the focused window is known
     } mClipboardState{OutdatedClipboard};
 
+    // Whether the latest paste has to be fetched once the persistent id of the focused window is known
+    bool mSyncPending{false};
+
     com::ubuntu::content::Hub *mContentHub;
 
     QDBusPendingCallWatcher *mPasteReply{nullptr};
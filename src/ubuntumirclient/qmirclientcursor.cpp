@@ -163,7 +163,8 @@ void QMirClientCursor::changeCursor(QCursor *windowCursor, QWindow *window)
         return;
     }
 
-    MirWindow *mirWindow = static_cast<QMirClientWindow*>(window->handle())->mirWindow();
+    // Windows get their cursor again once Mir has created them, see QMirClientWindow::handleSurfaceRealized()
+    MirWindow *mirWindow = static_cast<QMirClientWindow*>(window->handle())->createdMirWindow();
 
     if (!mirWindow) {
         return;
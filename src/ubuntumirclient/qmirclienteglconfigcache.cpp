@@ -0,0 +1,158 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclienteglconfigcache.h"
+#include "qmirclientlogging.h"
+
+#include <QMutexLocker>
+#include <QtPlatformSupport/private/qeglconvenience_p.h>
+
+#include <mir_toolkit/mir_client_library.h>
+
+namespace
+{
+
+MirPixelFormat disableAlphaBufferIfPossible(MirPixelFormat pixelFormat)
+{
+    switch (pixelFormat) {
+    case mir_pixel_format_abgr_8888:
+        return mir_pixel_format_xbgr_8888;
+    case mir_pixel_format_argb_8888:
+        return mir_pixel_format_xrgb_8888;
+    default: // can do nothing, leave it alone
+        return pixelFormat;
+    }
+}
+
+// Older Intel Atom-based devices only support OpenGL 1.4 compatibility profile but by default
+// QML asks for at least OpenGL 2.0. The XCB GLX backend ignores this request and returns a
+// 1.4 context, but the XCB EGL backend tries to honor it, and fails. The 1.4 context appears to
+// have sufficient capabilities on MESA (i915) to render correctly however. So reduce the default
+// requested OpenGL version to 1.0 to ensure EGL will give us a working context (lp:1549455).
+bool mesaFallbackFormat(EGLDisplay display, QSurfaceFormat *format)
+{
+    static const bool isMesa = QString(eglQueryString(display, EGL_VENDOR)).contains(QStringLiteral("Mesa"));
+    if (!isMesa || (format->majorVersion() == 1 && format->minorVersion() == 4)) {
+        return false;
+    }
+
+    qCDebug(mirclientGraphics, "Attempting to choose OpenGL 1.4 context which may suit Mesa");
+    format->setMajorVersion(1);
+    format->setMinorVersion(4);
+    return true;
+}
+
+} // namespace
+
+QMirClientEglConfigCache::QMirClientEglConfigCache(EGLDisplay display, MirConnection *connection)
+    : mEglDisplay(display)
+    , mMirConnection(connection)
+    , mHits(0)
+    , mMisses(0)
+{
+}
+
+QMirClientEglConfig QMirClientEglConfigCache::configForFormat(const QSurfaceFormat &requestedFormat)
+{
+    QMutexLocker lock(&mMutex);
+
+    for (const auto &entry : mEntries) {
+        if (entry.first == requestedFormat) {
+            ++mHits;
+            return entry.second;
+        }
+    }
+
+    ++mMisses;
+    const auto config = chooseConfig(requestedFormat);
+    mEntries.append(qMakePair(requestedFormat, config));
+
+    qCDebug(mirclientGraphics, "EGL config cache: %d formats cached (%d hits, %d misses)",
+            mEntries.count(), mHits, mMisses);
+    return config;
+}
+
+bool QMirClientEglConfigCache::fallbackConfigForFormat(const QSurfaceFormat &requestedFormat,
+                                                       QMirClientEglConfig *config)
+{
+    QSurfaceFormat format = requestedFormat;
+    if (!mesaFallbackFormat(mEglDisplay, &format)) {
+        return false;
+    }
+
+    *config = configForFormat(format);
+    return true;
+}
+
+QMirClientEglConfig QMirClientEglConfigCache::chooseConfig(const QSurfaceFormat &requestedFormat) const
+{
+    QMirClientEglConfig result;
+    QSurfaceFormat format = requestedFormat;
+
+    // Have Qt choose most suitable EGLConfig for the requested surface format, and update format to reflect it
+    EGLConfig config = q_configFromGLFormat(mEglDisplay, format, true);
+    if (config == 0 && mesaFallbackFormat(mEglDisplay, &format)) {
+        config = q_configFromGLFormat(mEglDisplay, format, true);
+    }
+    if (config == 0) {
+        qCritical() << "Qt failed to choose a suitable EGLConfig to suit the surface format" << format;
+    }
+
+    result.config = config;
+    result.format = q_glFormatFromConfig(mEglDisplay, config, format);
+    // That only describes the config itself, while contexts created for this format need to know
+    // what else was asked for, including the version the Mesa fallback settled for
+    result.format.setVersion(format.majorVersion(), format.minorVersion());
+    result.format.setProfile(format.profile());
+    result.format.setOptions(format.options());
+    result.format.setSwapBehavior(format.swapBehavior());
+
+    // Have Mir decide the pixel format most suited to the chosen EGLConfig. This is the only way
+    // Mir will know what EGLConfig has been chosen - it cannot deduce it from the buffers.
+    result.pixelFormat = mir_connection_get_egl_pixel_format(mMirConnection, mEglDisplay, config);
+    // But the chosen EGLConfig might have an alpha buffer enabled, even if not requested by the client.
+    // If that's the case, try to edit the chosen pixel format in order to disable the alpha buffer.
+    // This is an optimization for the compositor, as it can avoid blending this surface.
+    if (requestedFormat.alphaBufferSize() < 0) {
+        result.pixelFormat = disableAlphaBufferIfPossible(result.pixelFormat);
+    }
+
+    return result;
+}
@@ -0,0 +1,89 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMIRCLIENTEGLCONFIGCACHE_H
+#define QMIRCLIENTEGLCONFIGCACHE_H
+
+#include <QMutex>
+#include <QPair>
+#include <QSurfaceFormat>
+#include <QVector>
+
+#include <mir_toolkit/common.h> // needed only for MirPixelFormat enum
+
+#include <EGL/egl.h>
+
+struct MirConnection;
+
+struct QMirClientEglConfig
+{
+    EGLConfig config{nullptr};
+    QSurfaceFormat format; // the format actually provided by config, to create contexts with
+    MirPixelFormat pixelFormat{mir_pixel_format_invalid};
+};
+
+/*
+ * QMirClientEglConfigCache - remembers the EGLConfig and Mir pixel format chosen for each
+ * requested QSurfaceFormat, so that windows and contexts sharing a format don't have to
+ * enumerate the EGL configs again. Thread-safe.
+ */
+class QMirClientEglConfigCache
+{
+public:
+    QMirClientEglConfigCache(EGLDisplay display, MirConnection *connection);
+
+    QMirClientEglConfig configForFormat(const QSurfaceFormat &requestedFormat);
+    // The config to retry with when no valid context could be created for the requested format,
+    // if the driver is known to need one (lp:1549455)
+    bool fallbackConfigForFormat(const QSurfaceFormat &requestedFormat, QMirClientEglConfig *config);
+
+private:
+    QMirClientEglConfig chooseConfig(const QSurfaceFormat &requestedFormat) const;
+
+    const EGLDisplay mEglDisplay;
+    MirConnection * const mMirConnection;
+
+    QMutex mMutex;
+    QVector<QPair<QSurfaceFormat, QMirClientEglConfig>> mEntries; // few distinct formats, linear lookup is fine
+    int mHits;
+    int mMisses;
+};
+
+#endif // QMIRCLIENTEGLCONFIGCACHE_H
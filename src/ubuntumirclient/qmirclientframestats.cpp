@@ -0,0 +1,170 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientframestats.h"
+
+#include <QVector>
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+
+// Upper bounds of the frame interval histogram buckets, in milliseconds. The last bucket
+// collects everything above.
+const int histogramBucketsMs[] = { 8, 17, 25, 34, 50, 100 };
+const int histogramBucketCount = sizeof(histogramBucketsMs) / sizeof(histogramBucketsMs[0]) + 1;
+
+// Past this, a frame following continuous ones is taken as the end of an animation followed by a
+// new one, rather than as a hitch, unless an update was explicitly pending
+const qint64 maxHitchNs = 100 * 1000000;
+
+quint32 toMicroseconds(qint64 ns)
+{
+    return static_cast<quint32>(qBound<qint64>(0, ns / 1000, std::numeric_limits<quint32>::max()));
+}
+
+// Percentiles of the sorted samples, in milliseconds
+QVariantMap percentiles(const QVector<quint32> &sorted)
+{
+    QVariantMap map;
+    if (sorted.isEmpty()) {
+        return map;
+    }
+
+    auto at = [&sorted](int percent) {
+        const int index = qMin(sorted.count() - 1, sorted.count() * percent / 100);
+        return sorted.at(index) / 1000.0;
+    };
+    map.insert(QStringLiteral("p50"), at(50));
+    map.insert(QStringLiteral("p90"), at(90));
+    map.insert(QStringLiteral("p99"), at(99));
+    map.insert(QStringLiteral("max"), sorted.last() / 1000.0);
+    return map;
+}
+
+} // namespace
+
+QMirClientFrameStats::QMirClientFrameStats()
+    : mFrameCount(0)
+    , mLateFrames(0)
+    , mDroppedFrames(0)
+    , mPreviousIntervalNs(-1)
+{
+}
+
+void QMirClientFrameStats::recordFrame(qint64 swapDurationNs, qint64 intervalNs, qreal refreshRate, bool paced,
+                                       bool updateWasPending)
+{
+    const quint64 frame = mFrameCount.load();
+    const int slot = frame % SampleCount;
+
+    mSwapDurations[slot].storeRelease(toMicroseconds(swapDurationNs));
+    mIntervals[slot].storeRelease(intervalNs > 0 ? toMicroseconds(intervalNs) : 0);
+
+    if (intervalNs > 0 && refreshRate > 0 && !paced) {
+        // Allow for some jitter before calling a frame late
+        const qint64 periodNs = static_cast<qint64>(1000000000 / refreshRate);
+        const qint64 lateNs = periodNs * 3 / 2;
+
+        // Only a frame which was due right after the previous one can be late
+        const bool continuous = updateWasPending
+                || (mPreviousIntervalNs > 0 && mPreviousIntervalNs <= lateNs && intervalNs <= maxHitchNs);
+        if (continuous && intervalNs > lateNs) {
+            mLateFrames.fetchAndAddRelaxed(1);
+            mDroppedFrames.fetchAndAddRelaxed(static_cast<quint64>((intervalNs + periodNs / 2) / periodNs - 1));
+        }
+    }
+    mPreviousIntervalNs = paced ? -1 : intervalNs;
+
+    mFrameCount.storeRelease(frame + 1);
+}
+
+QVariantMap QMirClientFrameStats::summary() const
+{
+    const quint64 frameCount = mFrameCount.loadAcquire();
+    const int sampleCount = static_cast<int>(qMin<quint64>(frameCount, SampleCount));
+
+    QVector<quint32> swapDurations;
+    QVector<quint32> intervals;
+    swapDurations.reserve(sampleCount);
+    intervals.reserve(sampleCount);
+    QVariantList histogram;
+    int buckets[histogramBucketCount] = {};
+
+    for (int i = 0; i < sampleCount; ++i) {
+        swapDurations.append(mSwapDurations[i].loadAcquire());
+
+        const quint32 interval = mIntervals[i].loadAcquire();
+        if (interval == 0) {
+            continue;
+        }
+        intervals.append(interval);
+
+        int bucket = 0;
+        while (bucket < histogramBucketCount - 1 && interval > histogramBucketsMs[bucket] * 1000u) {
+            ++bucket;
+        }
+        ++buckets[bucket];
+    }
+
+    std::sort(swapDurations.begin(), swapDurations.end());
+    std::sort(intervals.begin(), intervals.end());
+
+    QVariantList bucketBounds;
+    for (int i = 0; i < histogramBucketCount; ++i) {
+        histogram.append(buckets[i]);
+        if (i < histogramBucketCount - 1) {
+            bucketBounds.append(histogramBucketsMs[i]);
+        }
+    }
+
+    QVariantMap map;
+    map.insert(QStringLiteral("frameCount"), frameCount);
+    map.insert(QStringLiteral("lateFrames"), mLateFrames.load());
+    map.insert(QStringLiteral("droppedFrames"), mDroppedFrames.load());
+    map.insert(QStringLiteral("sampleCount"), sampleCount);
+    map.insert(QStringLiteral("swapDuration"), percentiles(swapDurations));
+    map.insert(QStringLiteral("frameInterval"), percentiles(intervals));
+    map.insert(QStringLiteral("intervalHistogram"), histogram);
+    map.insert(QStringLiteral("intervalHistogramBounds"), bucketBounds);
+    return map;
+}
@@ -0,0 +1,85 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMIRCLIENTFRAMESTATS_H
+#define QMIRCLIENTFRAMESTATS_H
+
+#include <QAtomicInteger>
+#include <QVariantMap>
+
+/*
+ * QMirClientFrameStats - timing of the most recent frames of a window.
+ *
+ * Frames are recorded by the rendering thread into a fixed-size ring, without locking. The
+ * summary can be taken from any thread. A frame recorded while the summary is being taken may
+ * replace one of the samples being read, which is fine for statistics.
+ */
+class QMirClientFrameStats
+{
+public:
+    QMirClientFrameStats();
+
+    // Rendering thread only. intervalNs is negative for the first frame. Paced frames are held back
+    // on purpose (throttled or half rate windows), so they are never late. updateWasPending tells
+    // whether an update was already requested when the previous frame was swapped.
+    void recordFrame(qint64 swapDurationNs, qint64 intervalNs, qreal refreshRate, bool paced,
+                     bool updateWasPending);
+
+    // Frame counts, percentiles of swap durations and frame intervals, and a histogram of
+    // frame intervals. Times are in milliseconds.
+    QVariantMap summary() const;
+
+private:
+    enum { SampleCount = 128 };
+
+    // In microseconds, intervals are 0 when unknown
+    QAtomicInteger<quint32> mSwapDurations[SampleCount];
+    QAtomicInteger<quint32> mIntervals[SampleCount];
+
+    QAtomicInteger<quint64> mFrameCount;
+    // Only counted while rendering continuously: windows rendering on demand (widgets, a blinking
+    // cursor, idle scenes) would otherwise be late on almost every frame
+    QAtomicInteger<quint64> mLateFrames;    // presented after more than one refresh period
+    QAtomicInteger<quint64> mDroppedFrames; // refresh periods which passed without a new frame
+
+    qint64 mPreviousIntervalNs; // rendering thread only
+};
+
+#endif // QMIRCLIENTFRAMESTATS_H
@@ -42,11 +42,19 @@
 #include "qmirclientlogging.h"
 #include "qmirclientwindow.h"
 
+#include <QElapsedTimer>
+#include <QtMath>
 #include <QOpenGLFramebufferObject>
 #include <QtPlatformSupport/private/qeglconvenience_p.h>
 #include <QtPlatformSupport/private/qeglpbuffer_p.h>
 #include <QtGui/private/qopenglcontext_p.h>
 
+#include <EGL/eglext.h>
+
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+
 Q_LOGGING_CATEGORY(mirclientGraphics, "qt.qpa.mirclient.graphics", QtWarningMsg)
 
 namespace {
@@ -69,15 +77,45 @@ void printEglConfig(EGLDisplay display, EGLConfig config)
     q_printEglConfig(display, config);
 }
 
+// Damage rectangles as EGL wants them: x, y, width, height in pixels with the origin at the
+// bottom left of the surface
+QVector<EGLint> toEglDamage(const QRegion &damage, int surfaceHeight, qreal scale)
+{
+    QVector<EGLint> rects;
+    rects.reserve(damage.rectCount() * 4);
+    for (const QRect &rect : damage.rects()) {
+        // Round the edges outwards, rounding the size on its own could miss the last device pixel
+        const int left = qFloor(rect.x() * scale);
+        const int top = qFloor(rect.y() * scale);
+        const int right = qCeil((rect.x() + rect.width()) * scale);
+        const int bottom = qCeil((rect.y() + rect.height()) * scale);
+        rects << left << surfaceHeight - bottom << right - left << bottom - top;
+    }
+    return rects;
+}
+
 } // anonymous namespace
 
 QMirClientOpenGLContext::QMirClientOpenGLContext(const QSurfaceFormat &format, QPlatformOpenGLContext *share,
-                                         EGLDisplay display)
-    : QEGLPlatformContext(format, share, display, 0)
+                                         EGLDisplay display, EGLConfig config)
+    // Let Qt choose the config itself if none could be found for this format
+    : QEGLPlatformContext(format, share, display, config ? &config : nullptr)
 {
     if (mirclientGraphics().isDebugEnabled()) {
         printEglConfig(display, eglConfig());
     }
+
+    if (q_hasEglExtension(display, "EGL_KHR_swap_buffers_with_damage")) {
+        mSwapBuffersWithDamage = reinterpret_cast<SwapBuffersWithDamage>(
+                    eglGetProcAddress("eglSwapBuffersWithDamageKHR"));
+    } else if (q_hasEglExtension(display, "EGL_EXT_swap_buffers_with_damage")) {
+        mSwapBuffersWithDamage = reinterpret_cast<SwapBuffersWithDamage>(
+                    eglGetProcAddress("eglSwapBuffersWithDamageEXT"));
+    }
+    mHasBufferAge = q_hasEglExtension(display, "EGL_EXT_buffer_age");
+
+    qCDebug(mirclientGraphics, "Swap buffers with damage: %s, buffer age: %s",
+            mSwapBuffersWithDamage ? "yes" : "no", mHasBufferAge ? "yes" : "no");
 }
 
 static bool needsFBOReadBackWorkaround()
@@ -105,10 +143,30 @@ bool QMirClientOpenGLContext::makeCurrent(QPlatformSurface* surface)
         if (!ctx_d->workaround_brokenFBOReadBack && needsFBOReadBackWorkaround()) {
             ctx_d->workaround_brokenFBOReadBack = true;
         }
+
+        // The swap interval is a property of each window's buffer stream, while Qt only sets it
+        // once per context. So apply the window's own presentation mode once it's current.
+        if (surface->surface()->surfaceClass() == QSurface::Window) {
+            const int swapInterval = static_cast<QMirClientWindow *>(surface)->takeSwapIntervalChange();
+            if (swapInterval >= 0) {
+                qCDebug(mirclientGraphics, "Setting swap interval %d for window %p", swapInterval, surface);
+                eglSwapInterval(eglDisplay(), swapInterval);
+            }
+        }
     }
     return ret;
 }
 
+int QMirClientOpenGLContext::bufferAge(QPlatformSurface *surface)
+{
+    EGLint age = 0;
+    if (mHasBufferAge && !eglQuerySurface(eglDisplay(), eglSurfaceForPlatformSurface(surface),
+                                          EGL_BUFFER_AGE_EXT, &age)) {
+        age = 0;
+    }
+    return age;
+}
+
 // Following method used internally in the base class QEGLPlatformContext to access
 // the egl surface of a QPlatformSurface/QMirClientWindow
 EGLSurface QMirClientOpenGLContext::eglSurfaceForPlatformSurface(QPlatformSurface *surface)
@@ -116,17 +174,48 @@ EGLSurface QMirClientOpenGLContext::eglSurfaceForPlatformSurface(QPlatformSurfac
     if (surface->surface()->surfaceClass() == QSurface::Window) {
         return static_cast<QMirClientWindow *>(surface)->eglSurface();
     } else {
-        return static_cast<QEGLPbuffer *>(surface)->pbuffer();
+        // Surfaceless offscreen surfaces have no EGL surface at all
+        auto pbuffer = dynamic_cast<QEGLPbuffer *>(surface);
+        return pbuffer ? pbuffer->pbuffer() : EGL_NO_SURFACE;
     }
 }
 
 void QMirClientOpenGLContext::swapBuffers(QPlatformSurface *surface)
 {
-    QEGLPlatformContext::swapBuffers(surface);
+    if (surface->surface()->surfaceClass() == QSurface::Window) {
+        static_cast<QMirClientWindow *>(surface)->paceSwapBuffers();
+    }
+
+    QElapsedTimer swapTimer;
+    swapTimer.start();
+
+    QRegion damage;
+    if (mSwapBuffersWithDamage && surface->surface()->surfaceClass() == QSurface::Window) {
+        damage = static_cast<QMirClientWindow *>(surface)->takeSwapDamage();
+    }
+
+    // The window geometry belongs to the GUI thread, while EGL knows the size of the buffer
+    // being swapped
+    const EGLSurface eglSurface = eglSurfaceForPlatformSurface(surface);
+    EGLint surfaceHeight = 0;
+    if (!damage.isEmpty() && !eglQuerySurface(eglDisplay(), eglSurface, EGL_HEIGHT, &surfaceHeight)) {
+        damage = QRegion();
+    }
+
+    if (damage.isEmpty()) {
+        QEGLPlatformContext::swapBuffers(surface);
+    } else {
+        // Let the compositor only recomposite what changed
+        auto platformWindow = static_cast<QMirClientWindow *>(surface);
+        const auto rects = toEglDamage(damage, surfaceHeight, platformWindow->window()->devicePixelRatio());
+        if (!mSwapBuffersWithDamage(eglDisplay(), eglSurface, rects.constData(), rects.count() / 4)) {
+            qCWarning(mirclientGraphics, "eglSwapBuffersWithDamage failed: 0x%x", eglGetError());
+        }
+    }
 
     if (surface->surface()->surfaceClass() == QSurface::Window) {
         // notify window on swap completion
         auto platformWindow = static_cast<QMirClientWindow *>(surface);
-        platformWindow->onSwapBuffersDone();
+        platformWindow->onSwapBuffersDone(swapTimer.nsecsElapsed());
     }
 }
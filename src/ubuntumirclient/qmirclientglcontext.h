@@ -50,14 +50,24 @@ class QMirClientOpenGLContext : public QEGLPlatformContext
 {
 public:
     QMirClientOpenGLContext(const QSurfaceFormat &format, QPlatformOpenGLContext *share,
-                        EGLDisplay display);
+                        EGLDisplay display, EGLConfig config);
 
     // QEGLPlatformContext methods.
     void swapBuffers(QPlatformSurface *surface) final;
     bool makeCurrent(QPlatformSurface *surface) final;
 
+    // New methods.
+    // Number of frames ago the contents of the back buffer of the current surface were
+    // presented, or 0 if unknown (EGL_EXT_buffer_age)
+    int bufferAge(QPlatformSurface *surface);
+
 protected:
     EGLSurface eglSurfaceForPlatformSurface(QPlatformSurface *surface) final;
+
+private:
+    typedef EGLBoolean (EGLAPIENTRYP SwapBuffersWithDamage)(EGLDisplay, EGLSurface, const EGLint *, EGLint);
+    SwapBuffersWithDamage mSwapBuffersWithDamage{nullptr};
+    bool mHasBufferAge{false};
 };
 
 #endif // QMIRCLIENTGLCONTEXT_H
@@ -56,6 +56,9 @@
 #include <qpa/qwindowsysteminterface.h>
 #include <QTextCodec>
 
+#include <algorithm>
+#include <vector>
+
 #include <xkbcommon/xkbcommon.h>
 #include <xkbcommon/xkbcommon-keysyms.h>
 
@@ -167,6 +170,129 @@ static const uint32_t KeyTable[] = {
     0,                          0
 };
 
+struct KeyMapping
+{
+    uint32_t keysym;
+    uint32_t key;
+};
+
+// KeyTable sorted by keysym, for binary searching. Sorted on first use, as the table is too long
+// to keep it sorted by hand and C++11 can't sort it at compile time.
+const std::vector<KeyMapping> &sortedKeyTable()
+{
+    static const std::vector<KeyMapping> table = [] {
+        std::vector<KeyMapping> sorted;
+        for (int i = 0; KeyTable[i]; i += 2) {
+            sorted.push_back({KeyTable[i], KeyTable[i + 1]});
+        }
+        // Stable, so that the last of duplicate keysyms still wins as with a linear scan
+        std::stable_sort(sorted.begin(), sorted.end(), [](const KeyMapping &a, const KeyMapping &b) {
+            return a.keysym < b.keysym;
+        });
+        return sorted;
+    }();
+    return table;
+}
+
+// Keysyms up to 255 are Latin-1 characters, which only translate to keys with a Latin-1 locale.
+// The locale codec is looked up once.
+bool isLatin1Locale()
+{
+    static const bool latin1 = QTextCodec::codecForLocale()->mibEnum() == 4;
+    return latin1;
+}
+
+// Text of recently seen keysyms, so that key repeats and typing don't convert the same keysyms
+// over and over. Direct mapped, GUI thread only.
+class KeysymTextCache
+{
+public:
+    QString text(xkb_keysym_t keysym)
+    {
+        Entry &entry = mEntries[keysym % EntryCount];
+        if (!entry.valid || entry.keysym != keysym) {
+            char chars[32];
+            const int result = xkb_keysym_to_utf8(keysym, chars, sizeof(chars));
+            entry.text = result > 0 ? QString::fromUtf8(chars) : QString();
+            entry.keysym = keysym;
+            entry.valid = true;
+        }
+        return entry.text;
+    }
+
+private:
+    enum { EntryCount = 64 };
+    struct Entry
+    {
+        xkb_keysym_t keysym{0};
+        QString text;
+        bool valid{false};
+    };
+    Entry mEntries[EntryCount];
+};
+
+// Whether the event only moves pointers or touch points along, so that a later one may supersede it
+bool isMotionEvent(const MirEvent *event)
+{
+    if (mir_event_get_type(event) != mir_event_type_input)
+        return false;
+
+    const MirInputEvent *iev = mir_event_get_input_event(event);
+    switch (mir_input_event_get_type(iev)) {
+    case mir_input_event_type_pointer:
+    {
+        const MirPointerEvent *pev = mir_input_event_get_pointer_event(iev);
+        return mir_pointer_event_action(pev) == mir_pointer_action_motion
+                && mir_pointer_event_axis_value(pev, mir_pointer_axis_hscroll) == 0
+                && mir_pointer_event_axis_value(pev, mir_pointer_axis_vscroll) == 0;
+    }
+    case mir_input_event_type_touch:
+    {
+        const MirTouchEvent *tev = mir_input_event_get_touch_event(iev);
+        for (unsigned int i = 0; i < mir_touch_event_point_count(tev); ++i) {
+            if (mir_touch_event_action(tev, i) != mir_touch_action_change)
+                return false;
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Whether the motion event next leaves nothing of the motion event previous worth delivering:
+// same device, buttons, modifiers and touch points, only new positions
+bool supersedes(const MirEvent *previous, const MirEvent *next)
+{
+    if (!isMotionEvent(next))
+        return false;
+
+    const MirInputEvent *previousInput = mir_event_get_input_event(previous);
+    const MirInputEvent *nextInput = mir_event_get_input_event(next);
+    if (mir_input_event_get_type(previousInput) != mir_input_event_get_type(nextInput)
+            || mir_input_event_get_device_id(previousInput) != mir_input_event_get_device_id(nextInput))
+        return false;
+
+    if (mir_input_event_get_type(nextInput) == mir_input_event_type_pointer) {
+        const MirPointerEvent *previousPointer = mir_input_event_get_pointer_event(previousInput);
+        const MirPointerEvent *nextPointer = mir_input_event_get_pointer_event(nextInput);
+        return mir_pointer_event_buttons(previousPointer) == mir_pointer_event_buttons(nextPointer)
+                && mir_pointer_event_modifiers(previousPointer) == mir_pointer_event_modifiers(nextPointer);
+    }
+
+    const MirTouchEvent *previousTouch = mir_input_event_get_touch_event(previousInput);
+    const MirTouchEvent *nextTouch = mir_input_event_get_touch_event(nextInput);
+    const unsigned int pointCount = mir_touch_event_point_count(nextTouch);
+    if (mir_touch_event_point_count(previousTouch) != pointCount
+            || mir_touch_event_modifiers(previousTouch) != mir_touch_event_modifiers(nextTouch))
+        return false;
+    for (unsigned int i = 0; i < pointCount; ++i) {
+        if (mir_touch_event_id(previousTouch, i) != mir_touch_event_id(nextTouch, i))
+            return false;
+    }
+    return true;
+}
+
 Qt::WindowState mirWindowStateToQt(MirWindowState state)
 {
     switch (state) {
@@ -190,22 +316,6 @@ Qt::WindowState mirWindowStateToQt(MirWindowState state)
 
 } // namespace
 
-class UbuntuEvent : public QEvent
-{
-public:
-    UbuntuEvent(QMirClientWindow* window, const MirEvent *event, QEvent::Type type)
-        : QEvent(type), window(window) {
-        nativeEvent = mir_event_ref(event);
-    }
-    ~UbuntuEvent()
-    {
-        mir_event_unref(nativeEvent);
-    }
-
-    QPointer<QMirClientWindow> window;
-    const MirEvent *nativeEvent;
-};
-
 QMirClientInput::QMirClientInput(QMirClientClientIntegration* integration)
     : QObject(nullptr)
     , mIntegration(integration)
@@ -221,11 +331,32 @@ QMirClientInput::QMirClientInput(QMirClientClientIntegration* integration)
             QTouchDevice::Position | QTouchDevice::Area | QTouchDevice::Pressure |
             QTouchDevice::NormalizedPosition);
     QWindowSystemInterface::registerTouchDevice(mTouchDevice);
+
+    for (quint32 i = 0; i < RingSize; ++i) {
+        mRing[i].sequence.store(i);
+    }
 }
 
 QMirClientInput::~QMirClientInput()
 {
   // Qt will take care of deleting mTouchDevice.
+
+    qCDebug(mirclientInput, "Event queue stats: %u overflows, largest batch of %u events",
+            mOverflowCount.loadAcquire(), mMaxBatchSize);
+
+    // Release whatever never got delivered
+    for (quint32 pos = mRingTail; ; ++pos) {
+        RingSlot &slot = mRing[pos % RingSize];
+        if (slot.sequence.loadAcquire() != pos + 1)
+            break;
+        mir_event_unref(slot.event);
+    }
+    for (const QueuedEvent &queued : mOverflow) {
+        mir_event_unref(queued.event);
+    }
+    if (mHeldEvent.event) {
+        mir_event_unref(mHeldEvent.event);
+    }
 }
 
 static const char* nativeEventTypeToStr(MirEventType t)
@@ -265,62 +396,170 @@ static const char* nativeEventTypeToStr(MirEventType t)
 void QMirClientInput::customEvent(QEvent* event)
 {
     Q_ASSERT(QThread::currentThread() == thread());
-    UbuntuEvent* ubuntuEvent = static_cast<UbuntuEvent*>(event);
-    const MirEvent *nativeEvent = ubuntuEvent->nativeEvent;
+    if (event->type() == mEventType) {
+        drainEvents();
+    }
+}
+
+void QMirClientInput::drainEvents()
+{
+    // Events queued from now on need another wakeup. Clearing the flag must be a full barrier:
+    // a release store alone lets the reads of the ring below move ahead of it, missing an event
+    // whose producer still saw the flag set and didn't post a wakeup of its own.
+    mWakeupPending.fetchAndStoreOrdered(0);
+
+    quint32 batchSize = 0;
+    while (true) {
+        RingSlot &slot = mRing[mRingTail % RingSize];
+        if (slot.sequence.loadAcquire() != mRingTail + 1)
+            break;
+
+        const QPointer<QMirClientWindow> window = slot.window;
+        const MirEvent *event = slot.event;
+        slot.window.clear();
+        slot.event = nullptr;
+        // Hand the slot back to the producers, one lap further
+        slot.sequence.storeRelease(mRingTail + RingSize);
+        ++mRingTail;
+        ++batchSize;
+
+        processEvent(window, event);
+    }
+
+    // The ring is empty and producers don't use it while overflowing, so whatever overflowed
+    // comes next. Once taken, the ring is good to use again.
+    QVector<QueuedEvent> overflow;
+    if (mOverflowing.loadAcquire()) {
+        QMutexLocker lock(&mOverflowMutex);
+        overflow.swap(mOverflow);
+        mOverflowing.storeRelease(0);
+    }
+    for (const QueuedEvent &queued : overflow) {
+        processEvent(queued.window, queued.event);
+    }
+    batchSize += overflow.count();
+
+    // Nothing newer is left to supersede it
+    dispatchHeldEvent();
 
-    if ((ubuntuEvent->window == nullptr) || (ubuntuEvent->window->window() == nullptr)) {
+    mMaxBatchSize = qMax(mMaxBatchSize, batchSize);
+}
+
+void QMirClientInput::processEvent(const QPointer<QMirClientWindow> &window, const MirEvent *nativeEvent)
+{
+    if ((window == nullptr) || (window->window() == nullptr)) {
         qCWarning(mirclient) << "Attempted to deliver an event to a non-existent window, ignoring.";
+        mir_event_unref(nativeEvent);
         return;
     }
 
-    // Event filtering.
+    // Event filtering. Native event filters get to see every event, compressed or not.
     long result;
     if (QWindowSystemInterface::handleNativeEvent(
-            ubuntuEvent->window->window(), mEventFilterType,
+            window->window(), mEventFilterType,
             const_cast<void *>(static_cast<const void *>(nativeEvent)), &result) == true) {
         qCDebug(mirclient, "event filtered out by native interface");
+        mir_event_unref(nativeEvent);
+        return;
+    }
+
+    // Motion is held back in case the next event makes it redundant. Anything else goes out in
+    // order, after the held motion.
+    if (mHeldEvent.event) {
+        if (mHeldEvent.window == window && supersedes(mHeldEvent.event, nativeEvent)) {
+            // QMouseEvent has nowhere to carry the positions of merged pointer motion, so only
+            // touch points keep theirs
+            recordTouchHistory(mHeldEvent.event);
+            mir_event_unref(mHeldEvent.event);
+            mHeldEvent.event = nativeEvent;
+            return;
+        }
+        dispatchHeldEvent();
+    }
+
+    if (window->inputCompression() && isMotionEvent(nativeEvent)) {
+        mHeldEvent.window = window;
+        mHeldEvent.event = nativeEvent;
+        return;
+    }
+
+    dispatchEvent(window, nativeEvent);
+    mir_event_unref(nativeEvent);
+}
+
+void QMirClientInput::dispatchHeldEvent()
+{
+    if (!mHeldEvent.event)
         return;
+
+    dispatchEvent(mHeldEvent.window, mHeldEvent.event);
+    mir_event_unref(mHeldEvent.event);
+    mHeldEvent.window.clear();
+    mHeldEvent.event = nullptr;
+    mTouchHistory.clear();
+}
+
+void QMirClientInput::recordTouchHistory(const MirEvent *event)
+{
+    const MirInputEvent *iev = mir_event_get_input_event(event);
+    if (mir_input_event_get_type(iev) != mir_input_event_type_touch)
+        return;
+
+    const MirTouchEvent *tev = mir_input_event_get_touch_event(iev);
+    for (unsigned int i = 0; i < mir_touch_event_point_count(tev); ++i) {
+        mTouchHistory[mir_touch_event_id(tev, i)].append(QPointF(mir_touch_event_axis_value(tev, i, mir_touch_axis_x),
+                                                                 mir_touch_event_axis_value(tev, i, mir_touch_axis_y)));
     }
+}
 
-    qCDebug(mirclientInput, "customEvent(type=%s)", nativeEventTypeToStr(mir_event_get_type(nativeEvent)));
+void QMirClientInput::dispatchEvent(const QPointer<QMirClientWindow> &window, const MirEvent *nativeEvent)
+{
+    if ((window == nullptr) || (window->window() == nullptr)) {
+        qCWarning(mirclient) << "Attempted to deliver an event to a non-existent window, ignoring.";
+        return;
+    }
+
+    qCDebug(mirclientInput, "dispatchEvent(type=%s)", nativeEventTypeToStr(mir_event_get_type(nativeEvent)));
 
     // Event dispatching.
     switch (mir_event_get_type(nativeEvent))
     {
     case mir_event_type_input:
-        dispatchInputEvent(ubuntuEvent->window, mir_event_get_input_event(nativeEvent));
+        dispatchInputEvent(window, mir_event_get_input_event(nativeEvent));
         break;
     case mir_event_type_resize:
     {
-        auto resizeEvent = mir_event_get_resize_event(nativeEvent);
-
-        // Enable workaround for Screen rotation
-        auto const targetWindow = ubuntuEvent->window;
+        // Resize events are coalesced by the window: handle the newest size rather than the one
+        // carried by this event.
+        auto const targetWindow = window;
         if (targetWindow) {
+            const QSize size = targetWindow->takeLatestSurfaceSize();
+            if (!size.isValid()) {
+                // Already handled, or forwarded from a transparent child window
+                break;
+            }
+
+            // Enable workaround for Screen rotation
             auto const screen = static_cast<QMirClientScreen*>(targetWindow->screen());
             if (screen) {
-                screen->handleWindowSurfaceResize(
-                        mir_resize_event_get_width(resizeEvent),
-                        mir_resize_event_get_height(resizeEvent));
+                screen->handleWindowSurfaceResize(size.width(), size.height());
             }
 
-            targetWindow->handleSurfaceResized(
-                        mir_resize_event_get_width(resizeEvent),
-                        mir_resize_event_get_height(resizeEvent));
+            targetWindow->handleSurfaceResized(size.width(), size.height());
         }
         break;
     }
     case mir_event_type_window:
-        handleWindowEvent(ubuntuEvent->window, mir_event_get_window_event(nativeEvent));
+        handleWindowEvent(window, mir_event_get_window_event(nativeEvent));
         break;
     case mir_event_type_window_output:
-        handleWindowOutputEvent(ubuntuEvent->window, mir_event_get_window_output_event(nativeEvent));
+        handleWindowOutputEvent(window, mir_event_get_window_output_event(nativeEvent));
         break;
     case mir_event_type_orientation:
-        dispatchOrientationEvent(ubuntuEvent->window->window(), mir_event_get_orientation_event(nativeEvent));
+        dispatchOrientationEvent(window->window(), mir_event_get_orientation_event(nativeEvent));
         break;
     case mir_event_type_close_window:
-        QWindowSystemInterface::handleCloseEvent(ubuntuEvent->window->window());
+        QWindowSystemInterface::handleCloseEvent(window->window());
         break;
     default:
         qCDebug(mirclient, "unhandled event type: %d", static_cast<int>(mir_event_get_type(nativeEvent)));
@@ -331,14 +570,50 @@ void QMirClientInput::postEvent(QMirClientWindow *platformWindow, const MirEvent
 {
     QWindow *window = platformWindow->window();
 
-    QCoreApplication::postEvent(this, new UbuntuEvent(
-            platformWindow, event, mEventType));
+    queueEvent(platformWindow, event);
 
     if ((window->flags().testFlag(Qt::WindowTransparentForInput)) && window->parent()) {
-        QCoreApplication::postEvent(this, new UbuntuEvent(
-                    static_cast<QMirClientWindow*>(platformWindow->QPlatformWindow::parent()),
-                    event, mEventType));
+        queueEvent(static_cast<QMirClientWindow*>(platformWindow->QPlatformWindow::parent()), event);
     }
+
+    // One wakeup is enough for everything queued until the GUI thread gets to it
+    if (mWakeupPending.testAndSetOrdered(0, 1)) {
+        QCoreApplication::postEvent(this, new QEvent(mEventType));
+    }
+}
+
+void QMirClientInput::queueEvent(QMirClientWindow *window, const MirEvent *event)
+{
+    event = mir_event_ref(event);
+
+    if (!mOverflowing.loadAcquire()) {
+        quint32 pos = mRingHead.loadAcquire();
+        while (true) {
+            RingSlot &slot = mRing[pos % RingSize];
+            const qint32 lag = static_cast<qint32>(slot.sequence.loadAcquire() - pos);
+            if (lag == 0) {
+                // The slot is free, claim it unless another producer got there first
+                if (mRingHead.testAndSetOrdered(pos, pos + 1, pos)) {
+                    slot.window = window;
+                    slot.event = event;
+                    slot.sequence.storeRelease(pos + 1);
+                    return;
+                }
+            } else if (lag < 0) {
+                break; // the GUI thread hasn't read this slot yet, the ring is full
+            } else {
+                pos = mRingHead.loadAcquire();
+            }
+        }
+    }
+
+    QMutexLocker lock(&mOverflowMutex);
+    if (!mOverflowing.loadAcquire()) {
+        mOverflowCount.fetchAndAddRelaxed(1);
+        qCDebug(mirclientInput, "Event queue full, overflowing until the GUI thread catches up");
+        mOverflowing.storeRelease(1);
+    }
+    mOverflow.append(QueuedEvent(window, event));
 }
 
 void QMirClientInput::dispatchInputEvent(QMirClientWindow *window, const MirInputEvent *ev)
@@ -366,15 +641,27 @@ void QMirClientInput::dispatchTouchEvent(QMirClientWindow *window, const MirInpu
     // FIXME(loicm) Max pressure is device specific. That one is for the Samsung Galaxy Nexus. That
     //     needs to be fixed as soon as the compat input lib adds query support.
     const float kMaxPressure = 1.28;
-    const QRect kWindowGeometry = window->geometry();
-    QList<QWindowSystemInterface::TouchPoint> touchPoints;
+    const unsigned int kPointerCount = mir_touch_event_point_count(tev);
+
+    // The window may have moved without telling since the last gesture, so get its geometry
+    // afresh whenever a finger goes down
+    for (unsigned int i = 0; i < kPointerCount; ++i) {
+        if (mir_touch_event_action(tev, i) == mir_touch_action_down) {
+            window->invalidateInputGeometry();
+            break;
+        }
+    }
+    const QRect kWindowGeometry = window->inputGeometry();
 
+    // Only allocates when the number of fingers changes
+    while (mTouchPoints.count() > static_cast<int>(kPointerCount))
+        mTouchPoints.removeLast();
+    while (mTouchPoints.count() < static_cast<int>(kPointerCount))
+        mTouchPoints.append(QWindowSystemInterface::TouchPoint());
 
-    // TODO: Is it worth setting the Qt::TouchPointStationary ones? Currently they are left
-    //       as Qt::TouchPointMoved
-    const unsigned int kPointerCount = mir_touch_event_point_count(tev);
+    bool allStationary = true;
     for (unsigned int i = 0; i < kPointerCount; ++i) {
-        QWindowSystemInterface::TouchPoint touchPoint;
+        QWindowSystemInterface::TouchPoint &touchPoint = mTouchPoints[i];
 
         const float kX = mir_touch_event_axis_value(tev, i, mir_touch_axis_x) + kWindowGeometry.x();
         const float kY = mir_touch_event_axis_value(tev, i, mir_touch_axis_y) + kWindowGeometry.y(); // see bug lp:1346633 workaround comments elsewhere
@@ -386,6 +673,17 @@ void QMirClientInput::dispatchTouchEvent(QMirClientWindow *window, const MirInpu
         touchPoint.area = QRectF(kX - (kW / 2.0), kY - (kH / 2.0), kW, kH);
         touchPoint.pressure = kP / kMaxPressure;
 
+        // Positions of compressed motion, in screen coordinates, for velocity tracking
+        if (!touchPoint.rawPositions.isEmpty())
+            touchPoint.rawPositions.clear();
+        const auto history = mTouchHistory.constFind(touchPoint.id);
+        if (history != mTouchHistory.constEnd()) {
+            for (const QPointF &position : *history) {
+                touchPoint.rawPositions.append(position + kWindowGeometry.topLeft());
+            }
+            touchPoint.rawPositions.append(QPointF(kX, kY));
+        }
+
         MirTouchAction touch_action = mir_touch_event_action(tev, i);
         switch (touch_action)
         {
@@ -403,19 +701,52 @@ void QMirClientInput::dispatchTouchEvent(QMirClientWindow *window, const MirInpu
             Q_UNREACHABLE();
         }
 
-        touchPoints.append(touchPoint);
+        // Mir reports every finger of a gesture as changed, tell apart the ones which didn't
+        TouchState *last = nullptr;
+        for (TouchState &state : mTouchStates) {
+            if (state.id == touchPoint.id) {
+                last = &state;
+                break;
+            }
+        }
+        if (touchPoint.state == Qt::TouchPointReleased) {
+            if (last) {
+                *last = mTouchStates.last();
+                mTouchStates.removeLast();
+            }
+        } else {
+            if (!last) {
+                mTouchStates.append(TouchState());
+                last = &mTouchStates.last();
+                last->id = touchPoint.id;
+            } else if (touchPoint.state == Qt::TouchPointMoved && touchPoint.rawPositions.isEmpty()
+                       && last->area == touchPoint.area && last->pressure == touchPoint.pressure) {
+                touchPoint.state = Qt::TouchPointStationary;
+            }
+            last->area = touchPoint.area;
+            last->pressure = touchPoint.pressure;
+        }
+
+        if (touchPoint.state != Qt::TouchPointStationary)
+            allStationary = false;
+    }
+
+    // Nothing to tell, unless asked to repeat held fingers
+    static const bool suppressStationary = qEnvironmentVariableIsSet("QTUBUNTU_SUPPRESS_STATIONARY_TOUCH");
+    if (allStationary && suppressStationary) {
+        qCDebug(mirclientInput, "Dropping touch event without any change");
+        return;
     }
 
     ulong timestamp = mir_input_event_get_event_time(ev) / 1000000;
     QWindowSystemInterface::handleTouchEvent(window->window(), timestamp,
-            mTouchDevice, touchPoints);
+            mTouchDevice, mTouchPoints);
 }
 
 static uint32_t translateKeysym(uint32_t sym, const QString &text) {
     int code = 0;
 
-    QTextCodec *systemCodec = QTextCodec::codecForLocale();
-    if (sym < 128 || (sym < 256 && systemCodec->mibEnum() == 4)) {
+    if (sym < 128 || (sym < 256 && isLatin1Locale())) {
         // upper-case key, if known
         code = isprint((int)sym) ? toupper((int)sym) : 0;
     } else if (sym >= XKB_KEY_F1 && sym <= XKB_KEY_F35) {
@@ -425,9 +756,12 @@ static uint32_t translateKeysym(uint32_t sym, const QString &text) {
                && !(sym >= XKB_KEY_dead_grave && sym <= XKB_KEY_dead_currency)) {
         code = text.unicode()->toUpper().unicode();
     } else {
-        for (int i = 0; KeyTable[i]; i += 2)
-            if (sym == KeyTable[i])
-                code = KeyTable[i + 1];
+        const std::vector<KeyMapping> &table = sortedKeyTable();
+        auto it = std::upper_bound(table.begin(), table.end(), sym, [](uint32_t keysym, const KeyMapping &mapping) {
+            return keysym < mapping.keysym;
+        });
+        if (it != table.begin() && (--it)->keysym == sym)
+            code = it->key;
     }
 
     return code;
@@ -476,15 +810,8 @@ void QMirClientInput::dispatchKeyEvent(QMirClientWindow *window, const MirInputE
     if (action == mir_keyboard_action_down)
         mLastInputWindow = window;
 
-    QString text;
-    QVarLengthArray<char, 32> chars(32);
-    {
-        int result = xkb_keysym_to_utf8(xk_sym, chars.data(), chars.size());
-
-        if (result > 0) {
-            text = QString::fromUtf8(chars.constData());
-        }
-    }
+    static KeysymTextCache textCache;
+    const QString text = textCache.text(xk_sym);
     int sym = translateKeysym(xk_sym, text);
 
     bool is_auto_rep = action == mir_keyboard_action_repeat;
@@ -43,6 +43,11 @@
 
 // Qt
 #include <qpa/qwindowsysteminterface.h>
+#include <QAtomicInteger>
+#include <QHash>
+#include <QMutex>
+#include <QPointer>
+#include <QVector>
 
 #include <mir_toolkit/mir_client_library.h>
 
@@ -75,12 +80,69 @@ protected:
     void handleWindowOutputEvent(const QPointer<QMirClientWindow> &window, const MirWindowOutputEvent *event);
 
 private:
+    struct QueuedEvent
+    {
+        QueuedEvent() : event(nullptr) {}
+        QueuedEvent(QMirClientWindow *window, const MirEvent *event) : window(window), event(event) {}
+
+        QPointer<QMirClientWindow> window;
+        const MirEvent *event;
+    };
+
+    void queueEvent(QMirClientWindow *window, const MirEvent *event);
+    void drainEvents();
+    // Takes over the event reference
+    void processEvent(const QPointer<QMirClientWindow> &window, const MirEvent *event);
+    void dispatchHeldEvent();
+    void recordTouchHistory(const MirEvent *event);
+    void dispatchEvent(const QPointer<QMirClientWindow> &window, const MirEvent *event);
+
     QMirClientClientIntegration* mIntegration;
     QTouchDevice* mTouchDevice;
     const QByteArray mEventFilterType;
     const QEvent::Type mEventType;
 
     QMirClientWindow *mLastInputWindow;
+
+    // Events travel from the Mir event threads to the GUI thread through a bounded lock-free ring,
+    // with one wakeup event posted per batch. Each slot carries a sequence number telling whether
+    // it is free for the producer at a given position or ready for the consumer.
+    enum { RingSize = 256 };
+    struct RingSlot : QueuedEvent
+    {
+        QAtomicInteger<quint32> sequence;
+    };
+    RingSlot mRing[RingSize];
+    QAtomicInteger<quint32> mRingHead{0}; // next position to write, claimed by the producers
+    quint32 mRingTail{0}; // next position to read, only touched by the GUI thread
+    QAtomicInt mWakeupPending{0};
+
+    // Events that found the ring full, kept in order until the GUI thread has caught up
+    QMutex mOverflowMutex;
+    QVector<QueuedEvent> mOverflow;
+    QAtomicInt mOverflowing{0};
+
+    // Newest motion event of a drained batch, delivered once the next event doesn't supersede it.
+    // The positions of the motion it superseded are kept per touch point id.
+    QueuedEvent mHeldEvent;
+    QHash<int, QVector<QPointF>> mTouchHistory;
+
+    // Touch points of the previous touch event, overwritten in place by the next one.
+    // QWindowSystemInterface converts the list right away, so it is never shared for long.
+    QList<QWindowSystemInterface::TouchPoint> mTouchPoints;
+
+    // Last reported state of each finger down, to tell which ones stood still
+    struct TouchState
+    {
+        int id{0};
+        QRectF area; // centered on the position, in screen coordinates
+        qreal pressure{0};
+    };
+    QVector<TouchState> mTouchStates;
+
+    // Statistics, logged on destruction
+    QAtomicInteger<quint32> mOverflowCount{0};
+    quint32 mMaxBatchSize{0};
 };
 
 #endif // QMIRCLIENTINPUT_H
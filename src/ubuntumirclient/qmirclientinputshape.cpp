@@ -0,0 +1,181 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientinputshape.h"
+#include "qmirclientlogging.h"
+
+#include <QRegion>
+
+#include <algorithm>
+
+namespace
+{
+
+const int defaultBudget = 32;
+
+int rectangleBudget()
+{
+    bool ok;
+    const int budget = qEnvironmentVariableIntValue("QTUBUNTU_INPUT_SHAPE_MAX_RECTS", &ok);
+    return ok ? qMax(0, budget) : defaultBudget;
+}
+
+qint64 area(const QRect &rect)
+{
+    return static_cast<qint64>(rect.width()) * rect.height();
+}
+
+// How much area replacing both rectangles by their bounding rectangle adds, overlaps aside
+qint64 mergeCost(const QRect &a, const QRect &b)
+{
+    return area(a | b) - area(a) - area(b);
+}
+
+bool differ(const QVector<MirRectangle> &a, const QVector<MirRectangle> &b)
+{
+    if (a.count() != b.count()) {
+        return true;
+    }
+    for (int i = 0; i < a.count(); ++i) {
+        if (a[i].left != b[i].left || a[i].top != b[i].top
+                || a[i].width != b[i].width || a[i].height != b[i].height) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+QMirClientInputShape::QMirClientInputShape()
+    : mBudget(rectangleBudget())
+    , mCompiled(false)
+{
+}
+
+bool QMirClientInputShape::compile(const QRegion &region)
+{
+    mRects.resize(0);
+    for (const auto &rect : region.rects()) {
+        mRects.append(rect);
+    }
+    const int regionRectCount = mRects.count();
+
+    // QRegion already coalesces vertically adjacent bands covering the same horizontal spans
+    reduceToBudget();
+
+    // Keep the previous shape around to compare against, swapping keeps both allocations
+    mPreviousShape.swap(mShape);
+    mShape.resize(mRects.count());
+    for (int i = 0; i < mRects.count(); ++i) {
+        const auto &rect = mRects.at(i);
+        mShape[i] = MirRectangle{rect.x(), rect.y(),
+                                 static_cast<unsigned int>(rect.width()), static_cast<unsigned int>(rect.height())};
+    }
+
+    qCDebug(mirclient, "Compiled input shape from %d into %d rectangles", regionRectCount, mShape.count());
+
+    const bool changed = !mCompiled || differ(mShape, mPreviousShape);
+    mCompiled = true;
+    return changed;
+}
+
+void QMirClientInputShape::reduceToBudget()
+{
+    int count = mRects.count();
+    if (mBudget == 0 || count <= mBudget) {
+        return;
+    }
+
+    // Neighbours in band order are usually close to each other, so only those are considered.
+    // The rectangles form a linked list in which a merge keeps the first one. Candidate merges
+    // wait in a heap, and are dropped once either of their rectangles changed since.
+    mNext.resize(count);
+    mPrevious.resize(count);
+    mVersions.fill(0, count);
+    mCandidates.resize(0);
+    for (int i = 0; i < count; ++i) {
+        mPrevious[i] = i - 1;
+        mNext[i] = i + 1 < count ? i + 1 : -1;
+    }
+    for (int i = 0; i + 1 < count; ++i) {
+        pushCandidate(i, i + 1);
+    }
+
+    while (count > mBudget) {
+        std::pop_heap(mCandidates.begin(), mCandidates.end(), &MergeCandidate::costlier);
+        const MergeCandidate candidate = mCandidates.takeLast();
+        const int first = candidate.first;
+        const int second = candidate.second;
+        if (mVersions.at(first) != candidate.firstVersion || mVersions.at(second) != candidate.secondVersion) {
+            continue;
+        }
+
+        mRects[first] |= mRects.at(second);
+        ++mVersions[first];
+        ++mVersions[second];
+        mNext[first] = mNext.at(second);
+        if (mNext.at(first) >= 0) {
+            mPrevious[mNext.at(first)] = first;
+        }
+        --count;
+
+        if (mPrevious.at(first) >= 0) {
+            pushCandidate(mPrevious.at(first), first);
+        }
+        if (mNext.at(first) >= 0) {
+            pushCandidate(first, mNext.at(first));
+        }
+    }
+
+    // The first rectangle is never merged away, so the list still starts there
+    int out = 0;
+    for (int i = 0; i >= 0; i = mNext.at(i)) {
+        mRects[out++] = mRects.at(i);
+    }
+    mRects.resize(out);
+}
+
+void QMirClientInputShape::pushCandidate(int first, int second)
+{
+    mCandidates.append(MergeCandidate{mergeCost(mRects.at(first), mRects.at(second)), first, second,
+                                      mVersions.at(first), mVersions.at(second)});
+    std::push_heap(mCandidates.begin(), mCandidates.end(), &MergeCandidate::costlier);
+}
@@ -0,0 +1,100 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMIRCLIENTINPUTSHAPE_H
+#define QMIRCLIENTINPUTSHAPE_H
+
+#include <QRect>
+#include <QVector>
+
+#include <mir_toolkit/client_types.h>
+
+class QRegion;
+
+/*
+ * QMirClientInputShape - compiles a window mask into the rectangles of a Mir input shape.
+ *
+ * If the region has more rectangles than the budget allows, neighbouring rectangles are replaced
+ * by their bounding rectangle, cheapest first, until it fits. The approximated shape never accepts less input than the mask.
+ * Buffers are reused between compilations.
+ */
+class QMirClientInputShape
+{
+public:
+    QMirClientInputShape();
+
+    // Returns false if the compiled shape is the same as the one compiled last time
+    bool compile(const QRegion &region);
+
+    // Null if the region was empty
+    const MirRectangle *rectangles() const { return mShape.isEmpty() ? nullptr : mShape.constData(); }
+    int rectangleCount() const { return mShape.count(); }
+
+private:
+    struct MergeCandidate
+    {
+        qint64 cost;
+        int first;
+        int second;
+        int firstVersion;
+        int secondVersion;
+
+        // Orders the heap cheapest first, and in band order among equally cheap merges
+        static bool costlier(const MergeCandidate &a, const MergeCandidate &b)
+        {
+            return a.cost > b.cost || (a.cost == b.cost && a.first > b.first);
+        }
+    };
+
+    void reduceToBudget();
+    void pushCandidate(int first, int second);
+
+    const int mBudget; // 0 means unlimited
+    QVector<QRect> mRects;
+    QVector<int> mNext;
+    QVector<int> mPrevious;
+    QVector<int> mVersions;
+    QVector<MergeCandidate> mCandidates;
+    QVector<MirRectangle> mShape;
+    QVector<MirRectangle> mPreviousShape;
+    bool mCompiled;
+};
+
+#endif // QMIRCLIENTINPUTSHAPE_H
@@ -48,8 +48,10 @@
 #include "qmirclientinput.h"
 #include "qmirclientlogging.h"
 #include "qmirclientnativeinterface.h"
+#include "qmirclientoffscreensurface.h"
 #include "qmirclientscreen.h"
 #include "qmirclientwindow.h"
+#include "qmirclientwindowpool.h"
 #include "../shared/ubuntutheme.h"
 
 // Qt
@@ -133,6 +135,13 @@ QMirClientClientIntegration::QMirClientClientIntegration(int argc, char **argv)
     mEglNativeDisplay = mir_connection_get_egl_native_display(mMirConnection);
     ASSERT((mEglDisplay = eglGetDisplay(mEglNativeDisplay)) != EGL_NO_DISPLAY);
     ASSERT(eglInitialize(mEglDisplay, nullptr, nullptr) == EGL_TRUE);
+    mEglConfigCache.reset(new QMirClientEglConfigCache(mEglDisplay, mMirConnection));
+    mWindowPool.reset(new QMirClientWindowPool(mEglDisplay));
+
+    // Offscreen surfaces don't need a buffer if contexts can be made current without any
+    mSurfacelessContext = qEnvironmentVariableIsEmpty("QTUBUNTU_NO_SURFACELESS_CONTEXT")
+            && q_hasEglExtension(mEglDisplay, "EGL_KHR_surfaceless_context");
+    qCDebug(mirclientGraphics, "Surfaceless offscreen surfaces: %s", mSurfacelessContext ? "yes" : "no");
 
     // Has debug mode been requsted, either with "-testability" switch or QT_LOAD_TESTABILITY env var
     bool testability = qEnvironmentVariableIsSet("QT_LOAD_TESTABILITY");
@@ -182,6 +191,7 @@ void QMirClientClientIntegration::initialize()
 
 QMirClientClientIntegration::~QMirClientClientIntegration()
 {
+    mWindowPool.reset();
     eglTerminate(mEglDisplay);
     delete mInput;
     delete mInputContext;
@@ -258,7 +268,8 @@ QPlatformWindow* QMirClientClientIntegration::createPlatformWindow(QWindow* wind
         return new QMirClientDesktopWindow(window);
     } else {
         return new QMirClientWindow(window, mInput, mNativeInterface, mAppStateController.data(),
-                                    mEglDisplay, mMirConnection, mDebugExtension.data());
+                                    mEglDisplay, mEglConfigCache.data(), mWindowPool.data(), mMirConnection,
+                                    mDebugExtension.data());
     }
 }
 
@@ -301,23 +312,16 @@ QPlatformBackingStore* QMirClientClientIntegration::createPlatformBackingStore(Q
 QPlatformOpenGLContext* QMirClientClientIntegration::createPlatformOpenGLContext(
         QOpenGLContext* context) const
 {
-    QSurfaceFormat format(context->format());
-
-    auto platformContext = new QMirClientOpenGLContext(format, context->shareHandle(), mEglDisplay);
-    if (!platformContext->isValid()) {
-        // Older Intel Atom-based devices only support OpenGL 1.4 compatibility profile but by default
-        // QML asks for at least OpenGL 2.0. The XCB GLX backend ignores this request and returns a
-        // 1.4 context, but the XCB EGL backend tries to honor it, and fails. The 1.4 context appears to
-        // have sufficient capabilities on MESA (i915) to render correctly however. So reduce the default
-        // requested OpenGL version to 1.0 to ensure EGL will give us a working context (lp:1549455).
-        static const bool isMesa = QString(eglQueryString(mEglDisplay, EGL_VENDOR)).contains(QStringLiteral("Mesa"));
-        if (isMesa) {
-            qCDebug(mirclientGraphics, "Attempting to choose OpenGL 1.4 context which may suit Mesa");
-            format.setMajorVersion(1);
-            format.setMinorVersion(4);
-            delete platformContext;
-            platformContext = new QMirClientOpenGLContext(format, context->shareHandle(), mEglDisplay);
-        }
+    auto eglConfig = mEglConfigCache->configForFormat(context->format());
+    auto platformContext = new QMirClientOpenGLContext(eglConfig.format, context->shareHandle(), mEglDisplay,
+                                                       eglConfig.config);
+    // Some drivers provide a config for the requested format but then fail to create a context
+    // for it, see QMirClientEglConfigCache::fallbackConfigForFormat()
+    if (!platformContext->isValid()
+            && mEglConfigCache->fallbackConfigForFormat(context->format(), &eglConfig)) {
+        delete platformContext;
+        platformContext = new QMirClientOpenGLContext(eglConfig.format, context->shareHandle(), mEglDisplay,
+                                                      eglConfig.config);
     }
     return platformContext;
 }
@@ -367,6 +371,9 @@ QPlatformNativeInterface* QMirClientClientIntegration::nativeInterface() const
 QPlatformOffscreenSurface *QMirClientClientIntegration::createPlatformOffscreenSurface(
         QOffscreenSurface *surface) const
 {
+    if (mSurfacelessContext) {
+        return new QMirClientOffscreenSurface(surface);
+    }
     return new QEGLPbuffer(mEglDisplay, surface->requestedFormat(), surface);
 }
 
@@ -45,6 +45,7 @@
 #include <QSharedPointer>
 
 #include "qmirclientappstatecontroller.h"
+#include "qmirclienteglconfigcache.h"
 #include "qmirclientplatformservices.h"
 #include "qmirclientscreenobserver.h"
 
@@ -58,6 +59,7 @@ class QMirClientDebugExtension;
 class QMirClientInput;
 class QMirClientNativeInterface;
 class QMirClientScreen;
+class QMirClientWindowPool;
 struct MirConnection;
 
 class QMirClientClientIntegration : public QObject, public QPlatformIntegration
@@ -90,6 +92,7 @@ public:
     MirConnection *mirConnection() const { return mMirConnection; }
     EGLDisplay eglDisplay() const { return mEglDisplay; }
     EGLNativeDisplayType eglNativeDisplay() const { return mEglNativeDisplay; }
+    QMirClientEglConfigCache *eglConfigCache() const { return mEglConfigCache.data(); }
     QMirClientAppStateController *appStateController() const { return mAppStateController.data(); }
     QMirClientScreenObserver *screenObserver() const { return mScreenObserver.data(); }
     QMirClientDebugExtension *debugExtension() const { return mDebugExtension.data(); }
@@ -126,6 +129,9 @@ private:
     // EGL related
     EGLDisplay mEglDisplay{EGL_NO_DISPLAY};
     EGLNativeDisplayType mEglNativeDisplay;
+    QScopedPointer<QMirClientEglConfigCache> mEglConfigCache;
+    QScopedPointer<QMirClientWindowPool> mWindowPool;
+    bool mSurfacelessContext{false};
 };
 
 #endif // QMIRCLIENTINTEGRATION_H
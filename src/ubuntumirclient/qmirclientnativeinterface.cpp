@@ -46,10 +46,36 @@
 
 // Qt
 #include <QtGui/private/qguiapplication_p.h>
+#include <QtGui/qregion.h>
 #include <QtGui/qopenglcontext.h>
 #include <QtGui/qscreen.h>
 #include <QtCore/QMap>
 
+namespace {
+
+const char *presentationModeToStr(QMirClientWindow::PresentationMode mode)
+{
+    switch (mode) {
+    case QMirClientWindow::VSyncPresentation: return "vsync";
+    case QMirClientWindow::MailboxPresentation: return "mailbox";
+    case QMirClientWindow::HalfRatePresentation: return "halfrate";
+    case QMirClientWindow::DefaultPresentation: return "default";
+    }
+    Q_UNREACHABLE();
+}
+
+const char *occlusionPolicyToStr(QMirClientWindow::OcclusionPolicy policy)
+{
+    switch (policy) {
+    case QMirClientWindow::SuppressWhenOccluded: return "suppress";
+    case QMirClientWindow::ReleaseWhenOccluded: return "release";
+    case QMirClientWindow::RenderWhenOccluded: return "render";
+    }
+    Q_UNREACHABLE();
+}
+
+} // anonymous namespace
+
 class UbuntuResourceMap : public QMap<QByteArray, QMirClientNativeInterface::ResourceType>
 {
 public:
@@ -141,6 +167,7 @@ void* QMirClientNativeInterface::nativeResourceForWindow(const QByteArray& resou
         if (window) {
             auto ubuntuWindow = static_cast<QMirClientWindow*>(window->handle());
             if (ubuntuWindow) {
+                // Callers have always been handed a usable window, so wait for Mir to create it
                 return ubuntuWindow->mirWindow();
             } else {
                 return nullptr;
@@ -186,7 +213,10 @@ QVariantMap QMirClientNativeInterface::windowProperties(QPlatformWindow *window)
     if (w) {
         propertyMap.insert("scale", w->scale());
         propertyMap.insert("formFactor", w->formFactor());
-        propertyMap.insert("persistentSurfaceId", w->persistentSurfaceId());
+        const QString persistentSurfaceId = w->persistentSurfaceId();
+        if (!persistentSurfaceId.isEmpty()) { // not known yet
+            propertyMap.insert("persistentSurfaceId", persistentSurfaceId);
+        }
     }
     return propertyMap;
 }
@@ -202,8 +232,17 @@ QVariant QMirClientNativeInterface::windowProperty(QPlatformWindow *window, cons
         return w->scale();
     } else if (name == QStringLiteral("formFactor")) {
         return w->formFactor();
+    } else if (name == QStringLiteral("presentationMode")) {
+        return QString::fromLatin1(presentationModeToStr(w->presentationMode()));
+    } else if (name == QStringLiteral("occlusionPolicy")) {
+        return QString::fromLatin1(occlusionPolicyToStr(w->occlusionPolicy()));
+    } else if (name == QStringLiteral("inputCompression")) {
+        return w->inputCompression();
+    } else if (name == QStringLiteral("frameStats")) {
+        return w->frameStats();
     }  else if (name == QStringLiteral("persistentSurfaceId")) {
-        return w->persistentSurfaceId();
+        const QString persistentSurfaceId = w->persistentSurfaceId();
+        return persistentSurfaceId.isEmpty() ? QVariant() : persistentSurfaceId;
     } else {
         return QVariant();
     }
@@ -218,3 +257,25 @@ QVariant QMirClientNativeInterface::windowProperty(QPlatformWindow *window, cons
         return returnVal;
     }
 }
+
+void QMirClientNativeInterface::setWindowProperty(QPlatformWindow *window, const QString &name, const QVariant &value)
+{
+    auto w = static_cast<QMirClientWindow*>(window);
+    if (!w) {
+        return;
+    }
+
+    if (name == QStringLiteral("presentationMode")) {
+        w->setPresentationMode(QMirClientWindow::presentationModeFromString(value.toString()));
+        Q_EMIT windowPropertyChanged(window, name);
+    } else if (name == QStringLiteral("occlusionPolicy")) {
+        w->setOcclusionPolicy(QMirClientWindow::occlusionPolicyFromString(value.toString()));
+        Q_EMIT windowPropertyChanged(window, name);
+    } else if (name == QStringLiteral("inputCompression")) {
+        w->setInputCompression(value.toBool());
+        Q_EMIT windowPropertyChanged(window, name);
+    } else if (name == QStringLiteral("swapDamage")) {
+        // Only concerns the next frame, so nothing to notify
+        w->setSwapDamage(value.value<QRegion>());
+    }
+}
@@ -0,0 +1,65 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientresizecoalescer.h"
+
+QMirClientResizeCoalescer::QMirClientResizeCoalescer()
+    : mLatest(0)
+    , mPending(0)
+{
+}
+
+bool QMirClientResizeCoalescer::offer(int width, int height)
+{
+    // Only the latest size matters, so keep it in a single slot rather than queueing every one
+    mLatest.storeRelease((static_cast<quint64>(width) << 32) | static_cast<quint32>(height));
+    return mPending.testAndSetOrdered(0, 1);
+}
+
+QSize QMirClientResizeCoalescer::take()
+{
+    // Clear the flag before reading the size: a size offered after this point asks for a new event
+    if (!mPending.testAndSetOrdered(1, 0)) {
+        return QSize();
+    }
+
+    const quint64 size = mLatest.loadAcquire();
+    return QSize(static_cast<int>(size >> 32), static_cast<int>(size & 0xffffffff));
+}
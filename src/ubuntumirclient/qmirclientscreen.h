@@ -64,6 +64,7 @@ public:
     QRect geometry() const override { return mGeometry; }
     QRect availableGeometry() const override { return mGeometry; }
     QSizeF physicalSize() const override { return mPhysicalSize; }
+    qreal refreshRate() const override { return mRefreshRate; }
     qreal devicePixelRatio() const override { return mDevicePixelRatio; }
     QDpi logicalDpi() const override;
     Qt::ScreenOrientation nativeOrientation() const override { return mNativeOrientation; }
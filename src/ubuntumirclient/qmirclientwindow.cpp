@@ -41,22 +41,31 @@
 // Local
 #include "qmirclientwindow.h"
 #include "qmirclientdebugextension.h"
+#include "qmirclienteglconfigcache.h"
 #include "qmirclientnativeinterface.h"
 #include "qmirclientinput.h"
+#include "qmirclientinputshape.h"
 #include "qmirclientintegration.h"
+#include "qmirclientresizecoalescer.h"
 #include "qmirclientscreen.h"
 #include "qmirclientlogging.h"
+#include "qmirclientwindowpool.h"
 
 #include <mir_toolkit/mir_client_library.h>
 #include <mir_toolkit/version.h>
 
 // Qt
+#include <qpa/qplatformcursor.h>
+#include <qpa/qplatformscreen.h>
 #include <qpa/qwindowsysteminterface.h>
+#include <QCursor>
 #include <QMutexLocker>
+#include <QPointer>
 #include <QSize>
+#include <QWaitCondition>
 #include <QtMath>
+#include <QThread>
 #include <QtGui/private/qguiapplication_p.h>
-#include <QtPlatformSupport/private/qeglconvenience_p.h>
 
 #include <EGL/egl.h>
 
@@ -189,6 +198,42 @@ MirWindowType qtWindowTypeToMirWindowType(Qt::WindowType type)
     }
 }
 
+// Occluded windows which keep rendering on their own are throttled to this many frames per second
+const int occludedFramesPerSecond = 4;
+
+QMirClientWindow::OcclusionPolicy occlusionPolicyFor(QWindow *window)
+{
+    const QVariant windowPolicy = window->property("occlusionPolicy");
+    if (windowPolicy.isValid()) {
+        return QMirClientWindow::occlusionPolicyFromString(windowPolicy.toString());
+    }
+
+    static const QMirClientWindow::OcclusionPolicy envPolicy =
+            QMirClientWindow::occlusionPolicyFromString(QString::fromLatin1(qgetenv("QTUBUNTU_OCCLUSION_POLICY")));
+    return envPolicy;
+}
+
+bool inputCompressionFor(QWindow *window)
+{
+    const QVariant windowCompression = window->property("inputCompression");
+    if (windowCompression.isValid()) {
+        return windowCompression.toBool();
+    }
+
+    static const bool envCompression = qEnvironmentVariableIsEmpty("QTUBUNTU_NO_INPUT_COMPRESSION");
+    return envCompression;
+}
+
+int defaultSwapInterval(QWindow *window)
+{
+    static const int envSwapInterval = qEnvironmentVariableIsSet("QT_QPA_EGLFS_SWAPINTERVAL")
+            ? qgetenv("QT_QPA_EGLFS_SWAPINTERVAL").toInt() : -1;
+    if (envSwapInterval >= 0) {
+        return envSwapInterval;
+    }
+    return qMax(0, window->requestedFormat().swapInterval());
+}
+
 WId makeId()
 {
     static int id = 1;
@@ -221,6 +266,19 @@ bool requiresParent(const Qt::WindowType type)
     return requiresParent(qtWindowTypeToMirWindowType(type));
 }
 
+// Whether the window spec takes the parent, rather than having it set afterwards
+bool requiresParentAtCreation(const Qt::WindowType type)
+{
+    switch (qtWindowTypeToMirWindowType(type)) {
+    case mir_window_type_menu:
+    case mir_window_type_tip:
+    case mir_window_type_satellite:
+        return true;
+    default:
+        return false;
+    }
+}
+
 Spec makeSurfaceSpec(QWindow *window, MirPixelFormat pixelFormat, QMirClientWindow *parentWindowHandle,
                      MirConnection *connection)
 {
@@ -232,7 +290,8 @@ Spec makeSurfaceSpec(QWindow *window, MirPixelFormat pixelFormat, QMirClientWind
     MirRectangle location{geometry.x(), geometry.y(), 0, 0};
     MirWindow *parent = nullptr;
     if (parentWindowHandle) {
-        parent = parentWindowHandle->mirWindow();
+        // Null while Mir is still creating the parent, which is then attached once it is realized
+        parent = parentWindowHandle->createdMirWindow();
         // Qt uses absolute positioning, but Mir positions surfaces relative to parent.
         location.top  -= parentWindowHandle->geometry().top();
         location.left -= parentWindowHandle->geometry().left();
@@ -308,43 +367,22 @@ void setSizingConstraints(MirWindowSpec *spec, const QSize& minSize, const QSize
     }
 }
 
-void setMask(MirWindowSpec *spec, const QRegion& mask)
+void setInputShape(MirWindowSpec *spec, const QMirClientInputShape &inputShape)
 {
-    const int count = mask.rectCount();
-    if (count == 0) {
-        mir_window_spec_set_input_shape(spec, nullptr, 0);
-        return;
-    }
-
-    // Convert the QRegion into a list of MirRectangles
-    auto rects = new MirRectangle[count];
-
-    int i=0;
-    for (const auto &rect : mask.rects()) {
-        rects[i].left   = rect.x();
-        rects[i].top    = rect.y();
-        rects[i].width  = (unsigned int) rect.width();
-        rects[i].height = (unsigned int) rect.height();
-        i++;
-    }
-
-    mir_window_spec_set_input_shape(spec, rects, count);
+    // Mir copies the rectangles
+    mir_window_spec_set_input_shape(spec, inputShape.rectangles(), inputShape.rectangleCount());
 }
 
-MirWindow *createMirWindow(QWindow *window, int mirOutputId, QMirClientWindow *parentWindowHandle,
-                             MirPixelFormat pixelFormat, MirConnection *connection,
-                             MirWindowEventCallback inputCallback, void *inputContext)
+Spec makeWindowSpec(QWindow *window, int mirOutputId, QMirClientWindow *parentWindowHandle,
+                    MirPixelFormat pixelFormat, const QMirClientInputShape &inputShape, MirConnection *connection)
 {
     auto spec = makeSurfaceSpec(window, pixelFormat, parentWindowHandle, connection);
 
-    // Install event handler as early as possible
-    mir_window_spec_set_event_handler(spec.get(), inputCallback, inputContext);
-
     const auto title = window->title().toUtf8();
     mir_window_spec_set_name(spec.get(), title.constData());
 
     setSizingConstraints(spec.get(), window->minimumSize(), window->maximumSize(), window->sizeIncrement());
-    setMask(spec.get(), window->mask());
+    setInputShape(spec.get(), inputShape);
 
     if (window->windowState() == Qt::WindowFullScreen) {
         mir_window_spec_set_fullscreen_on_output(spec.get(), mirOutputId);
@@ -358,9 +396,28 @@ MirWindow *createMirWindow(QWindow *window, int mirOutputId, QMirClientWindow *p
         mir_window_spec_set_state(spec.get(), mir_window_state_hidden);
     }
 
-    auto surface = mir_create_window_sync(spec.get());
-    Q_ASSERT(mir_window_is_valid(surface));
-    return surface;
+    return spec;
+}
+
+void createMirWindow(QWindow *window, int mirOutputId, QMirClientWindow *parentWindowHandle,
+                     MirPixelFormat pixelFormat, const QMirClientInputShape &inputShape, MirConnection *connection,
+                     MirWindowEventCallback inputCallback, void *inputContext,
+                     MirWindowCallback createdCallback, void *context)
+{
+    auto spec = makeWindowSpec(window, mirOutputId, parentWindowHandle, pixelFormat, inputShape, connection);
+
+    // Install event handler as early as possible
+    mir_window_spec_set_event_handler(spec.get(), inputCallback, inputContext);
+
+    mir_create_window(spec.get(), createdCallback, context);
+}
+
+MirWindowState initialWindowState(QWindow *window)
+{
+    if (!window->isVisible()) {
+        return mir_window_state_hidden;
+    }
+    return window->windowState() == Qt::WindowFullScreen ? mir_window_state_fullscreen : mir_window_state_restored;
 }
 
 QMirClientWindow *getParentIfNecessary(QWindow *window, QMirClientInput *input)
@@ -372,23 +429,15 @@ QMirClientWindow *getParentIfNecessary(QWindow *window, QMirClientInput *input)
             // NOTE: Mir requires this surface have a parent. Try using the last surface to receive input as that will
             // most likely be the one that caused this surface to be created
             parentWindowHandle = input->lastInputWindow();
+        } else if (!parentWindowHandle->createdMirWindow() && requiresParentAtCreation(window->type())
+                   && input->lastInputWindow()) {
+            // Menus and tips can't be parented later on, and the window that got input exists
+            parentWindowHandle = input->lastInputWindow();
         }
     }
     return parentWindowHandle;
 }
 
-MirPixelFormat disableAlphaBufferIfPossible(MirPixelFormat pixelFormat)
-{
-    switch (pixelFormat) {
-    case mir_pixel_format_abgr_8888:
-        return mir_pixel_format_xbgr_8888;
-    case mir_pixel_format_argb_8888:
-        return mir_pixel_format_xrgb_8888;
-    default: // can do nothing, leave it alone
-        return pixelFormat;
-    }
-}
-
 // FIXME - in order to work around https://bugs.launchpad.net/mir/+bug/1346633
 // we need to guess the panel height (3GU)
 int panelHeight()
@@ -410,10 +459,13 @@ int panelHeight()
 
 
 
+struct PendingCallbacks;
+
 class UbuntuSurface
 {
 public:
-    UbuntuSurface(QMirClientWindow *platformWindow, EGLDisplay display, QMirClientInput *input, MirConnection *connection);
+    UbuntuSurface(QMirClientWindow *platformWindow, EGLDisplay display, QMirClientEglConfigCache *configCache,
+                  QMirClientWindowPool *windowPool, QMirClientInput *input, MirConnection *connection);
     ~UbuntuSurface();
 
     UbuntuSurface(const UbuntuSurface &) = delete;
@@ -425,143 +477,420 @@ public:
     void setMask(const QRegion &mask);
 
     void onSwapBuffersDone();
+    QSize takeLatestResize();
     void handleSurfaceResized(int width, int height);
-    int needsRepaint() const;
 
-    MirWindowState state() const { return mir_window_get_state(mMirWindow); }
+    // Shrinks the buffer stream of an occluded window to the minimum, and back
+    void releaseBuffers();
+    void restoreBuffers();
+
+    MirWindowState state() const
+    {
+        return mRealized && !mAwaitingFirstFrame.load() ? mir_window_get_state(mMirWindow) : mState;
+    }
     void setState(MirWindowState state);
+    // Shows a recycled window once it has new contents, see recycleMirWindow()
+    void applyDeferredState();
 
-    MirWindowType type() const { return mir_window_get_type(mMirWindow); }
+    // The requested type until the window is realized
+    MirWindowType type() const
+    {
+        return mRealized ? mir_window_get_type(mMirWindow) : qtWindowTypeToMirWindowType(mWindow->type());
+    }
 
     void setShellChrome(MirShellChrome shellChrome);
 
-    EGLSurface eglSurface() const { return mEglSurface; }
-    MirWindow *mirWindow() const { return mMirWindow; }
+    EGLSurface eglSurface();
+    // Waits for Mir to create the window
+    MirWindow *mirWindow();
+    // Returns nullptr while Mir is still creating the window
+    MirWindow *createdMirWindow();
+
+    // Whether the GUI thread has finished setting up the window after Mir created it
+    bool isRealized() const { return mRealized; }
+    // Whether the window came from the window pool, its EGL surface keeps its previous settings then
+    bool isRecycled() const { return mRecycled; }
+    bool completeRealization();
 
     void setSurfaceParent(MirWindow*);
     bool hasParent() const { return mParented; }
+    // The parent Mir was still creating when this window was created, it is attached once realized
+    QMirClientWindow *unrealizedParent() const { return mUnrealizedParent; }
+
+    void flushPendingSpec();
 
     QSurfaceFormat format() const { return mFormat; }
 
-    bool mNeedsExposeCatchup;
+    // Read on the rendering thread after every swap
+    QAtomicInt mNeedsExposeCatchup;
 
     QString persistentSurfaceId();
 
 private:
     static void surfaceEventCallback(MirWindow* surface, const MirEvent *event, void* context);
+    static void windowCreatedCallback(MirWindow *window, void *context);
+    static void persistentIdCallback(MirWindow *window, MirWindowId *id, void *context);
+    static void releaseIfOrphaned(PendingCallbacks *pending, QMutexLocker &lock);
+    bool recycleMirWindow(int mirOutputId);
     void postEvent(const MirEvent *event);
+    MirWindowSpec *pendingSpec();
 
     QWindow * const mWindow;
     QMirClientWindow * const mPlatformWindow;
     QMirClientInput * const mInput;
     MirConnection * const mConnection;
     QMirClientWindow * mParentWindowHandle{nullptr};
+    QPointer<QMirClientWindow> mParentWindowGuard;
+    QMirClientWindow *mUnrealizedParent{nullptr};
+    QMirClientWindowPool * const mWindowPool;
+    QMirClientWindowEventTarget *mEventTarget{nullptr};
+    PendingCallbacks *mPendingCallbacks{nullptr};
+    bool mRecycled{false};
+    // A recycled window stays hidden until the first frame of its new owner is swapped, as it
+    // would show the contents of its previous owner otherwise. Cleared on the rendering thread.
+    QAtomicInt mAwaitingFirstFrame;
+
+    // Set from Mir's thread once the window has been created, see windowCreatedCallback()
+    MirWindow* mMirWindow{nullptr};
+    QMutex mCreationMutex;
+    QWaitCondition mCreationCondition;
+    bool mRealized{false};
+    MirWindowState mState;
 
-    MirWindow* mMirWindow;
     const EGLDisplay mEglDisplay;
-    EGLSurface mEglSurface;
+    EGLConfig mEglConfig;
+    QMutex mEglSurfaceMutex;
+    QAtomicPointer<void> mEglSurface;
 
-    bool mNeedsRepaint;
     bool mParented;
+    quint64 mFrameNumber{0}; // rendering thread only
     QSize mBufferSize;
+    bool mBuffersReleased{false};
     QSurfaceFormat mFormat;
     MirPixelFormat mPixelFormat;
 
-    QMutex mTargetSizeMutex;
+    // Latest size Mir asked for, offered by Mir's event thread and taken by the GUI thread
+    QMirClientResizeCoalescer mResizes;
     QSize mTargetSize;
     MirShellChrome mShellChrome;
+    QMirClientInputShape mInputShape;
+
+    // Requested as soon as the window is created, guarded by mCreationMutex
     QString mPersistentIdStr;
+
+    // Changes to the window are accumulated in a single spec which is applied once per
+    // event loop iteration, or when explicitly flushed.
+    Spec mPendingSpec;
+    int mPendingSpecChanges{0};
+    quint64 mSpecChangeCount{0};
+    quint64 mSpecApplyCount{0};
+};
+
+/*
+ * PendingCallbacks - the context of Mir's replies to window creation and to the persistent id
+ * request. A surface destroyed before both have arrived doesn't wait for them: it leaves the
+ * window to the last reply, which then releases it.
+ */
+struct PendingCallbacks
+{
+    QMutex mutex;
+    UbuntuSurface *surface;  // null once the surface is gone
+    int outstanding{2};      // replies still to come
+    MirWindow *window{nullptr};
+
+    // Set once the surface is gone
+    QMirClientWindowPool *pool{nullptr};
+    QMirClientWindowEventTarget *eventTarget{nullptr};
+    EGLSurface eglSurface{EGL_NO_SURFACE};
 };
 
-UbuntuSurface::UbuntuSurface(QMirClientWindow *platformWindow, EGLDisplay display, QMirClientInput *input, MirConnection *connection)
+UbuntuSurface::UbuntuSurface(QMirClientWindow *platformWindow, EGLDisplay display, QMirClientEglConfigCache *configCache,
+                             QMirClientWindowPool *windowPool, QMirClientInput *input, MirConnection *connection)
     : mWindow(platformWindow->window())
     , mPlatformWindow(platformWindow)
     , mInput(input)
     , mConnection(connection)
+    , mWindowPool(windowPool)
+    , mState(initialWindowState(mWindow))
     , mEglDisplay(display)
-    , mNeedsRepaint(false)
+    , mEglSurface(EGL_NO_SURFACE)
     , mParented(mWindow->transientParent() || mWindow->parent())
-    , mFormat(mWindow->requestedFormat())
     , mShellChrome(mWindow->flags() & LowChromeWindowHint ? mir_shell_chrome_low : mir_shell_chrome_normal)
 {
-    // Have Qt choose most suitable EGLConfig for the requested surface format, and update format to reflect it
-    EGLConfig config = q_configFromGLFormat(display, mFormat, true);
-    if (config == 0) {
-        // Older Intel Atom-based devices only support OpenGL 1.4 compatibility profile but by default
-        // QML asks for at least OpenGL 2.0. The XCB GLX backend ignores this request and returns a
-        // 1.4 context, but the XCB EGL backend tries to honor it, and fails. The 1.4 context appears to
-        // have sufficient capabilities on MESA (i915) to render correctly however. So reduce the default
-        // requested OpenGL version to 1.0 to ensure EGL will give us a working context (lp:1549455).
-        static const bool isMesa = QString(eglQueryString(display, EGL_VENDOR)).contains(QStringLiteral("Mesa"));
-        if (isMesa) {
-            qCDebug(mirclientGraphics, "Attempting to choose OpenGL 1.4 context which may suit Mesa");
-            mFormat.setMajorVersion(1);
-            mFormat.setMinorVersion(4);
-            config = q_configFromGLFormat(display, mFormat, true);
+    // Windows sharing a format reuse the EGLConfig and Mir pixel format chosen for the first one
+    const auto eglConfig = configCache->configForFormat(mWindow->requestedFormat());
+    mEglConfig = eglConfig.config;
+    mFormat = eglConfig.format;
+    mPixelFormat = eglConfig.pixelFormat;
+
+    const auto outputId = static_cast<QMirClientScreen *>(mWindow->screen()->handle())->mirOutputId();
+
+    mParentWindowHandle = getParentIfNecessary(mWindow, input);
+    mParentWindowGuard = mParentWindowHandle;
+
+    mNeedsExposeCatchup = false;
+    mInputShape.compile(mWindow->mask());
+    if (recycleMirWindow(outputId)) {
+        return;
+    }
+
+    mEventTarget = new QMirClientWindowEventTarget;
+    mEventTarget->surface = this;
+    mPendingCallbacks = new PendingCallbacks;
+    mPendingCallbacks->surface = this;
+
+    // Rather than waiting for a parent Mir is still creating, create the window without it
+    if (mParentWindowHandle && !mParentWindowHandle->createdMirWindow()) {
+        mUnrealizedParent = mParentWindowHandle;
+    }
+
+    // Mir creates the window asynchronously. Until it does, changes to the window are held in the
+    // pending spec and the EGL surface is only bound when the window is first made current.
+    createMirWindow(mWindow, outputId, mParentWindowHandle, mPixelFormat, mInputShape, connection,
+                    surfaceEventCallback, mEventTarget, windowCreatedCallback, mPendingCallbacks);
+}
+
+UbuntuSurface::~UbuntuSurface()
+{
+    qCDebug(mirclient, "~UbuntuSurface(window=%p) - %llu window changes sent in %llu specs",
+            mWindow, mSpecChangeCount, mSpecApplyCount);
+
+    // Events still in flight on Mir's thread are dropped from now on
+    {
+        QMutexLocker lock(&mEventTarget->mutex);
+        mEventTarget->surface = nullptr;
+    }
+
+    // Pooled children can't outlive their parent
+    MirWindow *mirWindow = createdMirWindow();
+    if (mirWindow) {
+        mWindowPool->purgeChildrenOf(mirWindow);
+    }
+
+    if (mPendingCallbacks) {
+        // Creation or the persistent id request may still be in progress. Rather than waiting,
+        // leave the window to be released once Mir is done with it.
+        QMutexLocker lock(&mPendingCallbacks->mutex);
+        if (mPendingCallbacks->outstanding > 0) {
+            mPendingCallbacks->surface = nullptr;
+            mPendingCallbacks->pool = mWindowPool;
+            mPendingCallbacks->eventTarget = mEventTarget;
+            mPendingCallbacks->eglSurface = mEglSurface.load();
+            mWindowPool->deferRelease();
+            return;
         }
+        lock.unlock();
+        delete mPendingCallbacks;
     }
-    if (config == 0) {
-        qCritical() << "Qt failed to choose a suitable EGLConfig to suit the surface format" << mFormat;
+
+    const QMirClientWindowPool::Window window(mirWindow, mEglSurface.load(), mEventTarget, mPersistentIdStr);
+    const auto type = qtWindowTypeToMirWindowType(mWindow->type());
+    MirWindow *parent = mParentWindowGuard ? mParentWindowHandle->createdMirWindow() : nullptr;
+    if (QMirClientWindowPool::isPoolable(type) && parent) {
+        mWindowPool->put(parent, type, mPixelFormat, mEglConfig, window);
+    } else {
+        mWindowPool->release(window);
     }
+}
 
-    mFormat = q_glFormatFromConfig(display, config, mFormat);
+bool UbuntuSurface::recycleMirWindow(int mirOutputId)
+{
+    const auto type = qtWindowTypeToMirWindowType(mWindow->type());
+    if (!QMirClientWindowPool::isPoolable(type) || !mParentWindowHandle) {
+        return false;
+    }
 
-    // Have Mir decide the pixel format most suited to the chosen EGLConfig. This is the only way
-    // Mir will know what EGLConfig has been chosen - it cannot deduce it from the buffers.
-    mPixelFormat = mir_connection_get_egl_pixel_format(connection, display, config);
-    // But the chosen EGLConfig might have an alpha buffer enabled, even if not requested by the client.
-    // If that's the case, try to edit the chosen pixel format in order to disable the alpha buffer.
-    // This is an optimization for the compositor, as it can avoid blending this surface.
-    if (mWindow->requestedFormat().alphaBufferSize() < 0) {
-        mPixelFormat = disableAlphaBufferIfPossible(mPixelFormat);
+    // Nothing was pooled for a parent Mir is still creating
+    MirWindow *parent = mParentWindowHandle->createdMirWindow();
+    QMirClientWindowPool::Window pooled;
+    if (!parent || !mWindowPool->take(parent, type, mPixelFormat, mEglConfig, &pooled)) {
+        return false;
     }
 
-    const auto outputId = static_cast<QMirClientScreen *>(mWindow->screen()->handle())->mirOutputId();
+    mEventTarget = pooled.eventTarget;
+    {
+        QMutexLocker lock(&mEventTarget->mutex);
+        mEventTarget->surface = this;
+    }
 
-    mParentWindowHandle = getParentIfNecessary(mWindow, input);
+    // Re-parent, move, resize and rename the window in one go. It is only shown once it has been
+    // rendered to, see onSwapBuffersDone().
+    mAwaitingFirstFrame.store(1);
+    auto spec = makeWindowSpec(mWindow, mirOutputId, mParentWindowHandle, mPixelFormat, mInputShape, mConnection);
+    mir_window_apply_spec(pooled.window, spec.get());
+
+    const auto geometry = mWindow->geometry();
+    mir_buffer_stream_set_size(mir_window_get_buffer_stream(pooled.window),
+                               qMax(1, geometry.width()), qMax(1, geometry.height()));
+
+    mMirWindow = pooled.window;
+    mEglSurface.storeRelease(pooled.eglSurface);
+    mPersistentIdStr = pooled.persistentId;
+    mRecycled = true;
+
+    // Same as the asynchronous creation, the window is set up once the event loop gets to it
+    QMetaObject::invokeMethod(mPlatformWindow, "handleSurfaceRealized", Qt::QueuedConnection);
+    if (!mPersistentIdStr.isEmpty()) {
+        QMetaObject::invokeMethod(mPlatformWindow, "handlePersistentSurfaceIdReady", Qt::QueuedConnection);
+    }
+    return true;
+}
+
+void UbuntuSurface::windowCreatedCallback(MirWindow *window, void *context)
+{
+    Q_ASSERT(context != nullptr);
+    auto pending = static_cast<PendingCallbacks *>(context);
 
-    mMirWindow = createMirWindow(mWindow, outputId, mParentWindowHandle, mPixelFormat, connection, surfaceEventCallback, this);
-    mEglSurface = eglCreateWindowSurface(mEglDisplay, config, nativeWindowFor(mMirWindow), nullptr);
+    const bool valid = mir_window_is_valid(window);
+    if (!valid) {
+        qCritical("Mir failed to create window: %s", mir_window_get_error_message(window));
+    }
+    Q_ASSERT(valid);
+
+    QMutexLocker lock(&pending->mutex);
+    pending->window = window;
+    // There is no id to ask for without a window
+    pending->outstanding -= valid ? 1 : 2;
+
+    if (auto s = pending->surface) {
+        QMutexLocker creationLock(&s->mCreationMutex);
+        s->mMirWindow = window;
+        QMetaObject::invokeMethod(s->mPlatformWindow, "handleSurfaceRealized", Qt::QueuedConnection);
+        s->mCreationCondition.wakeAll();
+    }
 
-    mNeedsExposeCatchup = mir_window_get_visibility(mMirWindow) == mir_window_visibility_occluded;
+    if (!valid) {
+        releaseIfOrphaned(pending, lock);
+        return;
+    }
 
-    // Window manager can give us a final size different from what we asked for
-    // so let's check what we ended up getting
-    MirWindowParameters parameters;
-    mir_window_get_parameters(mMirWindow, &parameters);
+    // Prefetch the persistent id so that nobody has to wait for it later on. Its reply is still
+    // outstanding, so the pending callbacks stay alive.
+    lock.unlock();
+    mir_window_request_window_id(window, persistentIdCallback, pending);
+}
+
+void UbuntuSurface::persistentIdCallback(MirWindow *window, MirWindowId *id, void *context)
+{
+    Q_UNUSED(window);
+    Q_ASSERT(context != nullptr);
+    auto pending = static_cast<PendingCallbacks *>(context);
+
+    QMutexLocker lock(&pending->mutex);
+    if (auto s = pending->surface) {
+        QMutexLocker creationLock(&s->mCreationMutex);
+        if (mir_window_id_is_valid(id)) {
+            s->mPersistentIdStr = QString::fromLatin1(mir_window_id_as_string(id));
+            QMetaObject::invokeMethod(s->mPlatformWindow, "handlePersistentSurfaceIdReady", Qt::QueuedConnection);
+        } else {
+            qCWarning(mirclient, "Failed to retrieve the persistent id of window %p", s->mWindow);
+        }
+    }
+    mir_window_id_release(id);
+
+    --pending->outstanding;
+    releaseIfOrphaned(pending, lock);
+}
+
+void UbuntuSurface::releaseIfOrphaned(PendingCallbacks *pending, QMutexLocker &lock)
+{
+    if (pending->surface || pending->outstanding > 0) {
+        return; // the surface deletes the pending callbacks, or a later reply does
+    }
+
+    lock.unlock();
+    pending->pool->releaseDeferred(QMirClientWindowPool::Window(pending->window, pending->eglSurface,
+                                                                pending->eventTarget, QString()));
+    delete pending;
+}
+
+MirWindow *UbuntuSurface::createdMirWindow()
+{
+    QMutexLocker lock(&mCreationMutex);
+    return mMirWindow;
+}
+
+MirWindow *UbuntuSurface::mirWindow()
+{
+    QMutexLocker lock(&mCreationMutex);
+    while (!mMirWindow) {
+        mCreationCondition.wait(&mCreationMutex);
+    }
+    return mMirWindow;
+}
+
+bool UbuntuSurface::completeRealization()
+{
+    if (mRealized) {
+        return false;
+    }
+
+    auto window = mirWindow();
+    mRealized = true;
+
+    mNeedsExposeCatchup = mir_window_get_visibility(window) == mir_window_visibility_occluded;
 
     auto geom = mWindow->geometry();
-    geom.setWidth(parameters.width);
-    geom.setHeight(parameters.height);
+    if (mRecycled) {
+        // The window still has its previous size until Mir has applied the new spec, if the
+        // window manager settles on another size a resize event follows
+        geom.setWidth(qMax(1, geom.width()));
+        geom.setHeight(qMax(1, geom.height()));
+    } else {
+        // Window manager can give us a final size different from what we asked for
+        // so let's check what we ended up getting
+        MirWindowParameters parameters;
+        mir_window_get_parameters(window, &parameters);
+        geom.setWidth(parameters.width);
+        geom.setHeight(parameters.height);
+    }
 
     // Assume that the buffer size matches the surface size at creation time
     mBufferSize = geom.size();
-    platformWindow->QPlatformWindow::setGeometry(geom);
+    mPlatformWindow->QPlatformWindow::setGeometry(geom);
+    mPlatformWindow->invalidateInputGeometry();
     QWindowSystemInterface::handleGeometryChange(mWindow, geom);
 
-    qCDebug(mirclient) << "Created surface with geometry:" << geom << "title:" << mWindow->title();
+    // Send whatever changed while Mir was creating the window. A recycled window still shows its
+    // previous owner's buffer, so it stays hidden until handleFirstFrameSwapped() applies the state.
+    flushPendingSpec();
+    if (!mAwaitingFirstFrame.load() && mState != mir_window_get_state(window)) {
+        mir_window_set_state(window, mState);
+    }
+
+    qCDebug(mirclient) << (mRecycled ? "Recycled" : "Created") << "surface with geometry:" << geom
+                       << "title:" << mWindow->title();
     qCDebug(mirclientGraphics)
                        << "Requested format:" << mWindow->requestedFormat()
                        << "\nActual format:" << mFormat
                        << "with associated Mir pixel format:" << mirPixelFormatToStr(mPixelFormat);
+    return true;
 }
 
-UbuntuSurface::~UbuntuSurface()
+EGLSurface UbuntuSurface::eglSurface()
 {
-    if (mEglSurface != EGL_NO_SURFACE)
-        eglDestroySurface(mEglDisplay, mEglSurface);
-    if (mMirWindow) {
-        mir_window_release_sync(mMirWindow);
+    EGLSurface eglSurface = mEglSurface.loadAcquire();
+    if (Q_LIKELY(eglSurface != EGL_NO_SURFACE)) {
+        return eglSurface;
     }
+
+    // Bind the EGL surface lazily, the first time the window is made current
+    QMutexLocker lock(&mEglSurfaceMutex);
+    eglSurface = mEglSurface.loadAcquire();
+    if (eglSurface == EGL_NO_SURFACE) {
+        eglSurface = eglCreateWindowSurface(mEglDisplay, mEglConfig, nativeWindowFor(mirWindow()), nullptr);
+        mEglSurface.storeRelease(eglSurface);
+    }
+    return eglSurface;
 }
 
 void UbuntuSurface::updateGeometry(const QRect &newGeometry)
 {
 
-    auto spec = Spec{mir_create_window_spec(mConnection)};
+    auto spec = pendingSpec();
 
-    mir_window_spec_set_width(spec.get(), newGeometry.width());
-    mir_window_spec_set_height(spec.get(), newGeometry.height());
+    mir_window_spec_set_width(spec, newGeometry.width());
+    mir_window_spec_set_height(spec, newGeometry.height());
 
     MirRectangle mirRect {0,0,0,0};
 
@@ -580,69 +909,104 @@ void UbuntuSurface::updateGeometry(const QRect &newGeometry)
         mirRect.top = newGeometry.y();
     }
 
-    mir_window_spec_set_placement(spec.get(), &mirRect,
+    mir_window_spec_set_placement(spec, &mirRect,
             mir_placement_gravity_northwest /* rect_gravity */, mir_placement_gravity_northwest /* surface_gravity */,
             (MirPlacementHints)0, 0 /* offset_dx */, 0 /* offset_dy */);
-
-    mir_window_apply_spec(mMirWindow, spec.get());
 }
 
 void UbuntuSurface::updateTitle(const QString& newTitle)
 {
     const auto title = newTitle.toUtf8();
-    Spec spec{mir_create_window_spec(mConnection)};
-    mir_window_spec_set_name(spec.get(), title.constData());
-    mir_window_apply_spec(mMirWindow, spec.get());
+    mir_window_spec_set_name(pendingSpec(), title.constData());
 }
 
 void UbuntuSurface::setSizingConstraints(const QSize& minSize, const QSize& maxSize, const QSize& increment)
 {
-    Spec spec{mir_create_window_spec(mConnection)};
-    ::setSizingConstraints(spec.get(), minSize, maxSize, increment);
-    mir_window_apply_spec(mMirWindow, spec.get());
+    ::setSizingConstraints(pendingSpec(), minSize, maxSize, increment);
+}
+
+QSize UbuntuSurface::takeLatestResize()
+{
+    return mResizes.take();
 }
 
 void UbuntuSurface::handleSurfaceResized(int width, int height)
 {
-    QMutexLocker lock(&mTargetSizeMutex);
+    // mir's resize event is mainly a signal that we need to redraw our content. Stale resize
+    // events never reach this point, see postEvent().
+    mTargetSize = QSize(width, height);
 
-    // mir's resize event is mainly a signal that we need to redraw our content. We use the
-    // width/height as identifiers to figure out if this is the latest surface resize event
-    // that has posted, discarding any old ones. This avoids issuing too many redraw events.
-    // see TODO in postEvent as the ideal way we should handle this.
-    // The actual buffer size may or may have not changed at this point, so let the rendering
-    // thread drive the window geometry updates.
-    mNeedsRepaint = mTargetSize.width() == width && mTargetSize.height() == height;
+    if (!mRealized || mTargetSize == mBufferSize) {
+        return; // completeRealization() picks up the size Mir settled on
+    }
+
+    // Resize the buffer stream and the window geometry right away, rather than waiting for a
+    // buffer of the new size to come back from a swap. That way the next frame is already
+    // rendered at the new size and a resize only costs one redraw.
+    // Released buffers get the new size once restored.
+    if (!mBuffersReleased) {
+        mir_buffer_stream_set_size(mir_window_get_buffer_stream(mMirWindow), width, height);
+    }
+    mBufferSize = mTargetSize;
+
+    QRect newGeometry = mPlatformWindow->geometry();
+    newGeometry.setSize(mBufferSize);
+
+    mPlatformWindow->QPlatformWindow::setGeometry(newGeometry);
+    mPlatformWindow->invalidateInputGeometry();
+    QWindowSystemInterface::handleGeometryChange(mWindow, newGeometry);
 }
 
-int UbuntuSurface::needsRepaint() const
+void UbuntuSurface::releaseBuffers()
 {
-    if (mNeedsRepaint) {
-        if (mTargetSize != mBufferSize) {
-            //If the buffer hasn't changed yet, we need at least two redraws,
-            //once to get the new buffer size and propagate the geometry changes
-            //and the second to redraw the content at the new size
-            return 2;
-        } else {
-            // The buffer size has already been updated so we only need one redraw
-            // to render at the new size
-            return 1;
-        }
+    if (!mRealized || mBuffersReleased) {
+        return;
+    }
+
+    qCDebug(mirclientGraphics, "Releasing buffers of occluded window %p (size=(%dx%d)px)",
+            mWindow, mBufferSize.width(), mBufferSize.height());
+    mir_buffer_stream_set_size(mir_window_get_buffer_stream(mMirWindow), 1, 1);
+    mBuffersReleased = true;
+}
+
+void UbuntuSurface::restoreBuffers()
+{
+    if (!mBuffersReleased) {
+        return;
     }
-    return 0;
+
+    qCDebug(mirclientGraphics, "Restoring buffers of window %p (size=(%dx%d)px)",
+            mWindow, mBufferSize.width(), mBufferSize.height());
+    mir_buffer_stream_set_size(mir_window_get_buffer_stream(mMirWindow), mBufferSize.width(), mBufferSize.height());
+    mBuffersReleased = false;
 }
 
 void UbuntuSurface::setState(MirWindowState state)
 {
+    mState = state;
+    if (!mRealized || mAwaitingFirstFrame.load()) {
+        return; // applied once Mir has created the window, or it has been rendered to
+    }
+
+    // Make sure the server knows about any pending change (e.g. a new parent) before the state changes
+    flushPendingSpec();
     mir_window_set_state(mMirWindow, state);
 }
 
+void UbuntuSurface::applyDeferredState()
+{
+    if (!mRealized || mState == mir_window_get_state(mMirWindow)) {
+        return;
+    }
+
+    flushPendingSpec();
+    mir_window_set_state(mMirWindow, mState);
+}
+
 void UbuntuSurface::setShellChrome(MirShellChrome chrome)
 {
     if (chrome != mShellChrome) {
-        auto spec = Spec{mir_create_window_spec(mConnection)};
-        mir_window_spec_set_shell_chrome(spec.get(), chrome);
-        mir_window_apply_spec(mMirWindow, spec.get());
+        mir_window_spec_set_shell_chrome(pendingSpec(), chrome);
 
         mShellChrome = chrome;
     }
@@ -650,32 +1014,14 @@ void UbuntuSurface::setShellChrome(MirShellChrome chrome)
 
 void UbuntuSurface::onSwapBuffersDone()
 {
-    static int sFrameNumber = 0;
-    ++sFrameNumber;
-
-    EGLint eglSurfaceWidth = -1;
-    EGLint eglSurfaceHeight = -1;
-    eglQuerySurface(mEglDisplay, mEglSurface, EGL_WIDTH, &eglSurfaceWidth);
-    eglQuerySurface(mEglDisplay, mEglSurface, EGL_HEIGHT, &eglSurfaceHeight);
-
-    const bool validSize = eglSurfaceWidth > 0 && eglSurfaceHeight > 0;
-
-    if (validSize && (mBufferSize.width() != eglSurfaceWidth || mBufferSize.height() != eglSurfaceHeight)) {
-
-        qCDebug(mirclientBufferSwap, "onSwapBuffersDone(window=%p) [%d] - size changed (%d, %d) => (%d, %d)",
-               mWindow, sFrameNumber, mBufferSize.width(), mBufferSize.height(), eglSurfaceWidth, eglSurfaceHeight);
-
-        mBufferSize.rwidth() = eglSurfaceWidth;
-        mBufferSize.rheight() = eglSurfaceHeight;
-
-        QRect newGeometry = mPlatformWindow->geometry();
-        newGeometry.setSize(mBufferSize);
-
-        mPlatformWindow->QPlatformWindow::setGeometry(newGeometry);
-        QWindowSystemInterface::handleGeometryChange(mWindow, newGeometry);
-    } else {
-        qCDebug(mirclientBufferSwap, "onSwapBuffersDone(window=%p) [%d] - buffer size (%d,%d)",
-               mWindow, sFrameNumber, mBufferSize.width(), mBufferSize.height());
+    // Runs on the rendering thread for every frame: the buffer size is tracked from the resize
+    // events on the GUI thread (see handleSurfaceResized), so there is nothing to query or lock here.
+    ++mFrameNumber;
+    qCDebug(mirclientBufferSwap, "onSwapBuffersDone(window=%p) [%llu]", mWindow, mFrameNumber);
+
+    // The new contents are on their way, a recycled window can be shown now
+    if (Q_UNLIKELY(mAwaitingFirstFrame.load()) && mAwaitingFirstFrame.testAndSetOrdered(1, 0)) {
+        QMetaObject::invokeMethod(mPlatformWindow, "handleFirstFrameSwapped", Qt::QueuedConnection);
     }
 }
 
@@ -684,26 +1030,27 @@ void UbuntuSurface::surfaceEventCallback(MirWindow *surface, const MirEvent *eve
     Q_UNUSED(surface);
     Q_ASSERT(context != nullptr);
 
-    auto s = static_cast<UbuntuSurface *>(context);
-    s->postEvent(event);
+    auto target = static_cast<QMirClientWindowEventTarget *>(context);
+    QMutexLocker lock(&target->mutex);
+    if (target->surface) {
+        static_cast<UbuntuSurface *>(target->surface)->postEvent(event);
+    }
 }
 
 void UbuntuSurface::postEvent(const MirEvent *event)
 {
     const auto eventType = mir_event_get_type(event);
     if (mir_event_type_resize == eventType) {
-        // TODO: The current event queue just accumulates all resize events;
-        // It would be nicer if we could update just one event if that event has not been dispatched.
-        // As a workaround, we use the width/height as an identifier of this latest event
-        // so the event handler (handleSurfaceResized) can discard/ignore old ones.
+        // Only the latest size matters. Posting the first resize event of a burst is enough to
+        // wake the GUI thread.
         const auto resizeEvent = mir_event_get_resize_event(event);
         const auto width =  mir_resize_event_get_width(resizeEvent);
         const auto height =  mir_resize_event_get_height(resizeEvent);
         qCDebug(mirclient, "resizeEvent(window=%p, width=%d, height=%d)", mWindow, width, height);
 
-        QMutexLocker lock(&mTargetSizeMutex);
-        mTargetSize.rwidth() = width;
-        mTargetSize.rheight() = height;
+        if (!mResizes.offer(width, height)) {
+            return; // an event is already on its way
+        }
     }
 
     mInput->postEvent(mPlatformWindow, event);
@@ -714,27 +1061,51 @@ void UbuntuSurface::setSurfaceParent(MirWindow* parent)
     qCDebug(mirclient, "setSurfaceParent(window=%p)", mWindow);
 
     mParented = true;
-    Spec spec{mir_create_window_spec(mConnection)};
-    mir_window_spec_set_parent(spec.get(), parent);
-    mir_window_apply_spec(mMirWindow, spec.get());
+    mir_window_spec_set_parent(pendingSpec(), parent);
 }
 
 void UbuntuSurface::setMask(const QRegion &region)
 {
     qCDebug(mirclient).nospace() << "setMask(window=" << mWindow << ", region=" << region << ")";
 
-    Spec spec{mir_create_window_spec(mConnection)};
-    ::setMask(spec.get(), region);
-    mir_window_apply_spec(mMirWindow, spec.get());
+    if (!mInputShape.compile(region)) {
+        return; // nothing for Mir to do
+    }
+    setInputShape(pendingSpec(), mInputShape);
 }
 
-QString UbuntuSurface::persistentSurfaceId()
+MirWindowSpec *UbuntuSurface::pendingSpec()
 {
-    if (mPersistentIdStr.isEmpty()) {
-        auto id = mir_window_request_window_id_sync(mMirWindow);
-        mPersistentIdStr = mir_window_id_as_string(id);
-        mir_window_id_release(id);
+    ++mPendingSpecChanges;
+    ++mSpecChangeCount;
+
+    if (!mPendingSpec) {
+        mPendingSpec = Spec{mir_create_window_spec(mConnection)};
+
+        // Apply all the changes made during this event loop iteration in one go
+        QMetaObject::invokeMethod(mPlatformWindow, "flushPendingSpec", Qt::QueuedConnection);
     }
+    return mPendingSpec.get();
+}
+
+void UbuntuSurface::flushPendingSpec()
+{
+    if (!mPendingSpec || !mRealized) {
+        return;
+    }
+
+    mir_window_apply_spec(mMirWindow, mPendingSpec.get());
+    mPendingSpec.reset();
+    ++mSpecApplyCount;
+
+    qCDebug(mirclient, "flushPendingSpec(window=%p) - %d changes applied (total: %llu changes, %llu applies, %llu saved)",
+            mWindow, mPendingSpecChanges, mSpecChangeCount, mSpecApplyCount, mSpecChangeCount - mSpecApplyCount);
+    mPendingSpecChanges = 0;
+}
+
+QString UbuntuSurface::persistentSurfaceId()
+{
+    QMutexLocker lock(&mCreationMutex);
     return mPersistentIdStr;
 }
 
@@ -742,6 +1113,7 @@ Q_DECLARE_METATYPE(QPlatformWindow*)
 
 QMirClientWindow::QMirClientWindow(QWindow *w, QMirClientInput *input, QMirClientNativeInterface *native,
                                    QMirClientAppStateController *appState, EGLDisplay eglDisplay,
+                                   QMirClientEglConfigCache *eglConfigCache, QMirClientWindowPool *windowPool,
                                    MirConnection *mirConnection, QMirClientDebugExtension *debugExt)
     : QObject(nullptr)
     , QPlatformWindow(w)
@@ -749,12 +1121,20 @@ QMirClientWindow::QMirClientWindow(QWindow *w, QMirClientInput *input, QMirClien
     , mWindowState(w->windowState())
     , mWindowFlags(w->flags())
     , mWindowVisible(false)
+    , mWindowExposed(false)
     , mAppStateController(appState)
     , mDebugExtention(debugExt)
     , mNativeInterface(native)
-    , mSurface(new UbuntuSurface{this, eglDisplay, input, mirConnection})
+    , mSurface(new UbuntuSurface{this, eglDisplay, eglConfigCache, windowPool, input, mirConnection})
     , mScale(1.0)
     , mFormFactor(mir_form_factor_unknown)
+    , mPresentationMode(presentationModeFromString(w->property("presentationMode").toString()))
+    , mOcclusionPolicy(occlusionPolicyFor(w))
+    , mOccluded(false)
+    , mInputCompression(inputCompressionFor(w))
+    // A recycled EGL surface still has the swap interval of its previous owner, so apply one
+    // even for the default mode
+    , mAppliedPresentationMode(mSurface->isRecycled() ? -1 : DefaultPresentation)
 {
     static bool metaTypeRegistered = false;
     if (Q_UNLIKELY(!metaTypeRegistered)) {
@@ -762,17 +1142,23 @@ QMirClientWindow::QMirClientWindow(QWindow *w, QMirClientInput *input, QMirClien
         metaTypeRegistered = true;
     }
 
-    mWindowExposed = mSurface->mNeedsExposeCatchup == false;
-
     qCDebug(mirclient, "QMirClientWindow(window=%p, screen=%p, input=%p, surf=%p) with title '%s'",
             w, w->screen()->handle(), input, mSurface.get(), qPrintable(window()->title()));
 
     updatePanelHeightHack(mSurface->state() != mir_window_state_fullscreen);
 
-    // queue the windowPropertyChanged signal. If it's emitted directly, the platformWindow will not yet be set for the window.
-    QMetaObject::invokeMethod(mNativeInterface, "windowPropertyChanged", Qt::QueuedConnection,
-                              Q_ARG(QPlatformWindow*, this),
-                              Q_ARG(QString, "persistentSurfaceId"));
+    if (auto parent = mSurface->unrealizedParent()) {
+        connect(parent, &QMirClientWindow::surfaceRealized, this, [this, parent]() {
+            QMutexLocker lock(&mMutex);
+            mSurface->setSurfaceParent(parent->createdMirWindow());
+        });
+    }
+
+    static const bool asyncCreation = qEnvironmentVariableIsEmpty("QTUBUNTU_NO_ASYNC_WINDOW_CREATION");
+    if (!asyncCreation) {
+        // Wait for Mir to create the window right away
+        handleSurfaceRealized();
+    }
 }
 
 QMirClientWindow::~QMirClientWindow()
@@ -780,6 +1166,52 @@ QMirClientWindow::~QMirClientWindow()
     qCDebug(mirclient, "~QMirClientWindow(window=%p)", this);
 }
 
+void QMirClientWindow::handleSurfaceRealized()
+{
+    QMutexLocker lock(&mMutex);
+    if (!mSurface->completeRealization()) {
+        return;
+    }
+    qCDebug(mirclient, "handleSurfaceRealized(window=%p)", window());
+
+    mWindowExposed = mSurface->mNeedsExposeCatchup == false;
+    mOccluded = !mWindowExposed;
+    lock.unlock();
+
+    updatePanelHeightHack(mSurface->state() != mir_window_state_fullscreen);
+
+    // The cursor couldn't be set while Mir was creating the window
+    if (auto platformCursor = screen() ? screen()->cursor() : nullptr) {
+        QCursor cursor = window()->cursor();
+        platformCursor->changeCursor(&cursor, window());
+    }
+
+    // Nothing could be rendered until now, see isExposed()
+    if (mWindowVisible) {
+        QWindowSystemInterface::handleExposeEvent(window(), QRect(QPoint(), geometry().size()));
+    }
+
+    Q_EMIT surfaceRealized();
+}
+
+void QMirClientWindow::handleFirstFrameSwapped()
+{
+    QMutexLocker lock(&mMutex);
+    qCDebug(mirclient, "handleFirstFrameSwapped(window=%p)", window());
+    mSurface->applyDeferredState();
+}
+
+void QMirClientWindow::handlePersistentSurfaceIdReady()
+{
+    qCDebug(mirclient, "handlePersistentSurfaceIdReady(window=%p)", window());
+    Q_EMIT mNativeInterface->windowPropertyChanged(this, QStringLiteral("persistentSurfaceId"));
+}
+
+QSize QMirClientWindow::takeLatestSurfaceSize()
+{
+    return mSurface->takeLatestResize();
+}
+
 void QMirClientWindow::handleSurfaceResized(int width, int height)
 {
     QMutexLocker lock(&mMutex);
@@ -787,15 +1219,11 @@ void QMirClientWindow::handleSurfaceResized(int width, int height)
 
     mSurface->handleSurfaceResized(width, height);
 
-    // This resize event could have occurred just after the last buffer swap for this window.
-    // This means the client may still be holding a buffer with the older size. The first redraw call
-    // will then render at the old size. After swapping the client now will get a new buffer with the
-    // updated size but it still needs re-rendering so another redraw may be needed.
-    // A mir API to drop the currently held buffer would help here, so that we wouldn't have to redraw twice
-    auto const numRepaints = mSurface->needsRepaint();
+    // The buffer stream and geometry already have the new size, so a single redraw renders
+    // the content at that size. Throttled windows repaint once exposed again instead.
+    auto const needsRepaint = !isThrottled();
     lock.unlock();
-    qCDebug(mirclient, "handleSurfaceResize(window=%p) redraw %d times", window(), numRepaints);
-    for (int i = 0; i < numRepaints; i++) {
+    if (needsRepaint) {
         qCDebug(mirclient, "handleSurfaceResize(window=%p) repainting size=(%dx%d)dp", window(), geometry().size().width(), geometry().size().height());
         QWindowSystemInterface::handleExposeEvent(window(), QRect(QPoint(), geometry().size()));
     }
@@ -809,6 +1237,10 @@ void QMirClientWindow::handleSurfaceExposeChange(bool exposed)
     mSurface->mNeedsExposeCatchup = false;
     if (mWindowExposed == exposed) return;
     mWindowExposed = exposed;
+    mOccluded = !exposed;
+
+    // Buffers need to be back before the expose event triggers a repaint
+    applyOcclusionPolicyLocked();
 
     lock.unlock();
     QWindowSystemInterface::handleExposeEvent(window(), QRect(QPoint(), geometry().size()));
@@ -899,13 +1331,14 @@ void QMirClientWindow::updatePanelHeightHack(bool enable)
     if (newGeometry != geometry()) {
         lock.unlock();
         QPlatformWindow::setGeometry(newGeometry);
+        invalidateInputGeometry();
         QWindowSystemInterface::handleGeometryChange(window(), newGeometry);
     }
 }
 
 QRect QMirClientWindow::geometry() const
 {
-    if (mDebugExtention) {
+    if (mDebugExtention && mSurface->isRealized()) {
         auto geom = QPlatformWindow::geometry();
         geom.moveTopLeft(mDebugExtention->mapWindowPointToScreen(mSurface->mirWindow(), QPoint(0,0)));
         return geom;
@@ -914,6 +1347,15 @@ QRect QMirClientWindow::geometry() const
     }
 }
 
+QRect QMirClientWindow::inputGeometry()
+{
+    if (!mInputGeometryValid.load()) {
+        mInputGeometry = geometry();
+        mInputGeometryValid.store(1);
+    }
+    return mInputGeometry;
+}
+
 void QMirClientWindow::setGeometry(const QRect &rect)
 {
     QMutexLocker lock(&mMutex);
@@ -929,6 +1371,7 @@ void QMirClientWindow::setGeometry(const QRect &rect)
     QRect newPosition(geometry());
     newPosition.moveTo(rect.topLeft());
     QPlatformWindow::setGeometry(newPosition);
+    invalidateInputGeometry();
 
     mSurface->updateGeometry(rect);
     // Note: don't call handleGeometryChange here, wait to see what Mir replies with.
@@ -947,8 +1390,10 @@ void QMirClientWindow::setVisible(bool visible)
             // The dialog may have been parented after creation time
             // so morph it into a modal dialog
             auto parent = transientParentFor(window());
-            if (parent) {
-                mSurface->setSurfaceParent(parent->mirWindow());
+            // One Mir is still creating is attached once realized, see surfaceRealized()
+            MirWindow *parentMirWindow = parent ? parent->createdMirWindow() : nullptr;
+            if (parentMirWindow) {
+                mSurface->setSurfaceParent(parentMirWindow);
             }
         }
     }
@@ -978,8 +1423,9 @@ void QMirClientWindow::propagateSizeHints()
 
 bool QMirClientWindow::isExposed() const
 {
+    // Nothing can be rendered until Mir has created the window, see handleSurfaceRealized().
     // mNeedsExposeCatchup because we need to render a frame to get the expose surface event from mir.
-    return mWindowVisible && (mWindowExposed || (mSurface && mSurface->mNeedsExposeCatchup));
+    return mWindowVisible && mSurface->isRealized() && (mWindowExposed || (mSurface && mSurface->mNeedsExposeCatchup));
 }
 
 void QMirClientWindow::setMask(const QRegion &region)
@@ -992,9 +1438,18 @@ QSurfaceFormat QMirClientWindow::format() const
     return mSurface->format();
 }
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+void QMirClientWindow::requestUpdate()
+{
+    // Tells the frame statistics that the next frame is due right away
+    mUpdateRequested.store(1);
+    QPlatformWindow::requestUpdate();
+}
+#endif
+
 QPoint QMirClientWindow::mapToGlobal(const QPoint &pos) const
 {
-    if (mDebugExtention) {
+    if (mDebugExtention && mSurface->isRealized()) {
         return mDebugExtention->mapWindowPointToScreen(mSurface->mirWindow(), pos);
     } else {
         return pos;
@@ -1011,22 +1466,187 @@ MirWindow *QMirClientWindow::mirWindow() const
     return mSurface->mirWindow();
 }
 
+MirWindow *QMirClientWindow::createdMirWindow() const
+{
+    return mSurface->createdMirWindow();
+}
+
 WId QMirClientWindow::winId() const
 {
     return mId;
 }
 
-void QMirClientWindow::onSwapBuffersDone()
+QMirClientWindow::PresentationMode QMirClientWindow::presentationModeFromString(const QString &mode)
+{
+    if (mode == QLatin1String("vsync")) {
+        return VSyncPresentation;
+    } else if (mode == QLatin1String("mailbox")) {
+        return MailboxPresentation;
+    } else if (mode == QLatin1String("halfrate")) {
+        return HalfRatePresentation;
+    } else {
+        return DefaultPresentation;
+    }
+}
+
+void QMirClientWindow::setPresentationMode(PresentationMode mode)
+{
+    qCDebug(mirclient, "setPresentationMode(window=%p, mode=%d)", window(), mode);
+    // Picked up by the rendering thread the next time the window is made current
+    mPresentationMode.store(mode);
+}
+
+QMirClientWindow::OcclusionPolicy QMirClientWindow::occlusionPolicyFromString(const QString &policy)
+{
+    if (policy == QLatin1String("suppress")) {
+        return SuppressWhenOccluded;
+    } else if (policy == QLatin1String("release")) {
+        return ReleaseWhenOccluded;
+    } else {
+        return RenderWhenOccluded;
+    }
+}
+
+void QMirClientWindow::setOcclusionPolicy(OcclusionPolicy policy)
 {
+    qCDebug(mirclient, "setOcclusionPolicy(window=%p, policy=%d)", window(), policy);
+    if (mOcclusionPolicy.fetchAndStoreRelaxed(policy) == policy) {
+        return;
+    }
+
     QMutexLocker lock(&mMutex);
+    applyOcclusionPolicyLocked();
+}
+
+void QMirClientWindow::setInputCompression(bool enabled)
+{
+    qCDebug(mirclientInput, "setInputCompression(window=%p, enabled=%d)", window(), enabled);
+    mInputCompression = enabled;
+}
+
+void QMirClientWindow::applyOcclusionPolicy()
+{
+    QMutexLocker lock(&mMutex);
+    applyOcclusionPolicyLocked();
+}
+
+void QMirClientWindow::applyOcclusionPolicyLocked()
+{
+    // Keep the buffers while the first frame is due, Mir only reports the window as exposed
+    // once it has something to show, see isExposed()
+    if (occlusionPolicy() == ReleaseWhenOccluded && !mWindowExposed && !mSurface->mNeedsExposeCatchup) {
+        mSurface->releaseBuffers();
+    } else {
+        mSurface->restoreBuffers();
+    }
+}
+
+bool QMirClientWindow::isThrottled() const
+{
+    return mOccluded.load() && occlusionPolicy() != RenderWhenOccluded && !mSurface->mNeedsExposeCatchup.load();
+}
+
+void QMirClientWindow::setSwapDamage(const QRegion &damage)
+{
+    QMutexLocker lock(&mSwapDamageMutex);
+    mSwapDamage = damage;
+    mHasSwapDamage.storeRelease(!damage.isEmpty());
+}
+
+QRegion QMirClientWindow::takeSwapDamage()
+{
+    // Most frames come without damage, so only lock if there is some
+    if (!mHasSwapDamage.loadAcquire()) {
+        return QRegion();
+    }
+
+    QMutexLocker lock(&mSwapDamageMutex);
+    QRegion damage;
+    damage.swap(mSwapDamage);
+    mHasSwapDamage.storeRelease(0);
+
+    // Damage reaching outside the window means the whole window
+    if (!QRect(QPoint(), window()->size()).contains(damage.boundingRect())) {
+        return QRegion();
+    }
+    return damage;
+}
+
+int QMirClientWindow::takeSwapIntervalChange()
+{
+    const int mode = mPresentationMode.load();
+    if (Q_LIKELY(mode == mAppliedPresentationMode)) {
+        return -1;
+    }
+    mAppliedPresentationMode = mode;
+
+    switch (mode) {
+    case MailboxPresentation:
+        return 0;
+    case VSyncPresentation:
+    case HalfRatePresentation: // Mir can't skip vsyncs itself, see paceSwapBuffers()
+        return 1;
+    case DefaultPresentation:
+    default:
+        return defaultSwapInterval(window());
+    }
+}
+
+void QMirClientWindow::paceSwapBuffers()
+{
+    if (!mLastSwapTimer.isValid()) {
+        return;
+    }
+
+    qint64 framePeriodNs;
+    if (Q_LIKELY(!isThrottled() && mPresentationMode.load() != HalfRatePresentation)) {
+        return;
+    } else if (QThread::currentThread() == thread()) {
+        // Rendering on the GUI thread (basic render loop, widgets), which must not sleep. Throttled
+        // windows don't get expose events to render for anyway, and half rate behaves as vsync.
+        return;
+    } else if (isThrottled()) {
+        // Applications rendering on their own, regardless of expose events, still get a few frames
+        framePeriodNs = 1000000000 / occludedFramesPerSecond;
+    } else {
+        // Mir's swaps don't block while its buffer queue has room, so the previous swap may have
+        // returned anywhere between two vsyncs. Issuing this one just short of two refresh periods
+        // after it lets it make the second vsync without catching the first one.
+        const qreal refreshRate = screen() && screen()->refreshRate() > 0 ? screen()->refreshRate() : 60;
+        const qint64 refreshPeriodNs = static_cast<qint64>(1000000000 / refreshRate);
+        framePeriodNs = 2 * refreshPeriodNs - refreshPeriodNs / 8;
+    }
+
+    const qint64 remainingNs = framePeriodNs - mLastSwapTimer.nsecsElapsed();
+    if (remainingNs > 0) {
+        QThread::usleep(static_cast<unsigned long>(remainingNs / 1000));
+    }
+}
+
+void QMirClientWindow::onSwapBuffersDone(qint64 swapDurationNs)
+{
     mSurface->onSwapBuffersDone();
 
-    if (mSurface->mNeedsExposeCatchup) {
-        mSurface->mNeedsExposeCatchup = false;
+    const qreal refreshRate = screen() ? screen()->refreshRate() : 0;
+    const bool paced = isThrottled() || mPresentationMode.load() == HalfRatePresentation;
+    mFrameStats.recordFrame(swapDurationNs, mLastSwapTimer.isValid() ? mLastSwapTimer.nsecsElapsed() : -1, refreshRate,
+                            paced, mUpdateWasPending);
+    mLastSwapTimer.start();
+    mUpdateWasPending = mUpdateRequested.fetchAndStoreRelaxed(0);
+
+    // The catch up only happens for the first frame, so only lock in that case
+    if (Q_UNLIKELY(mSurface->mNeedsExposeCatchup.load())
+            && mSurface->mNeedsExposeCatchup.testAndSetOrdered(1, 0)) {
+        QMutexLocker lock(&mMutex);
         mWindowExposed = false;
 
         lock.unlock();
         QWindowSystemInterface::handleExposeEvent(window(), QRect(QPoint(), geometry().size()));
+
+        if (occlusionPolicy() == ReleaseWhenOccluded) {
+            // The buffers are only released once the frame is done, so leave it to the GUI thread
+            QMetaObject::invokeMethod(this, "applyOcclusionPolicy", Qt::QueuedConnection);
+        }
     }
 }
 
@@ -1066,3 +1686,9 @@ QString QMirClientWindow::persistentSurfaceId()
 {
     return mSurface->persistentSurfaceId();
 }
+
+void QMirClientWindow::flushPendingSpec()
+{
+    QMutexLocker lock(&mMutex);
+    mSurface->flushPendingSpec();
+}
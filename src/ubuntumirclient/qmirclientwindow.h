@@ -42,9 +42,12 @@
 #define QMIRCLIENTWINDOW_H
 
 #include <qpa/qplatformwindow.h>
+#include <QElapsedTimer>
 #include <QSharedPointer>
 #include <QMutex>
 
+#include "qmirclientframestats.h"
+
 #include <mir_toolkit/common.h> // needed only for MirFormFactor enum
 #include <mir_toolkit/mir_window.h>
 
@@ -54,9 +57,11 @@
 
 class QMirClientAppStateController;
 class QMirClientDebugExtension;
+class QMirClientEglConfigCache;
 class QMirClientNativeInterface;
 class QMirClientInput;
 class QMirClientScreen;
+class QMirClientWindowPool;
 class UbuntuSurface;
 struct MirConnection;
 
@@ -64,8 +69,24 @@ class QMirClientWindow : public QObject, public QPlatformWindow
 {
     Q_OBJECT
 public:
+    // How buffer swaps of the window are paced
+    enum PresentationMode {
+        DefaultPresentation,  // swap interval chosen by Qt (QT_QPA_EGLFS_SWAPINTERVAL or the surface format)
+        VSyncPresentation,    // swaps block until the next vsync
+        MailboxPresentation,  // swaps never block, the compositor shows the latest frame
+        HalfRatePresentation  // presents at most every other vsync
+    };
+
+    // What happens to the window while it is fully covered by other windows
+    enum OcclusionPolicy {
+        RenderWhenOccluded,   // nothing special, the application decides what to render
+        SuppressWhenOccluded, // no expose-driven repaints, and swaps are throttled
+        ReleaseWhenOccluded   // as above, and the buffer stream is shrunk until exposed again
+    };
+
     QMirClientWindow(QWindow *w, QMirClientInput *input, QMirClientNativeInterface *native,
                      QMirClientAppStateController *appState, EGLDisplay eglDisplay,
+                     QMirClientEglConfigCache *eglConfigCache, QMirClientWindowPool *windowPool,
                      MirConnection *mirConnection, QMirClientDebugExtension *debugExt);
     virtual ~QMirClientWindow();
 
@@ -83,26 +104,71 @@ public:
 
     QPoint mapToGlobal(const QPoint &pos) const override;
     QSurfaceFormat format() const override;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 5, 0)
+    void requestUpdate() override;
+#endif
 
     // Additional Window properties exposed by NativeInterface
     MirFormFactor formFactor() const { return mFormFactor; }
     float scale() const { return mScale; }
+    PresentationMode presentationMode() const { return static_cast<PresentationMode>(mPresentationMode.load()); }
+    void setPresentationMode(PresentationMode mode);
+    static PresentationMode presentationModeFromString(const QString &mode);
+    OcclusionPolicy occlusionPolicy() const { return static_cast<OcclusionPolicy>(mOcclusionPolicy.load()); }
+    void setOcclusionPolicy(OcclusionPolicy policy);
+    static OcclusionPolicy occlusionPolicyFromString(const QString &policy);
+    // Whether consecutive motion events may be merged before delivery, GUI thread only
+    bool inputCompression() const { return mInputCompression; }
+    void setInputCompression(bool enabled);
+    QVariantMap frameStats() const { return mFrameStats.summary(); }
+    // Region (in device independent pixels) changed by the next frame, the whole window by default
+    void setSwapDamage(const QRegion &damage);
 
     // New methods.
+    // Snapshot of geometry() for mapping input, which spares the debug extension a round trip per
+    // event. Refreshed after geometry changes, or when asked to. GUI thread only.
+    QRect inputGeometry();
+    void invalidateInputGeometry() { mInputGeometryValid.store(0); }
     void *eglSurface() const;
+    // Waits for Mir to create the window
     MirWindow *mirWindow() const;
+    // Returns nullptr while Mir is still creating the window
+    MirWindow *createdMirWindow() const;
+    // Returns the newest size Mir resized the window to, or an invalid size if it was already taken
+    QSize takeLatestSurfaceSize();
     void handleSurfaceResized(int width, int height);
     void handleSurfaceExposeChange(bool exposed);
     void handleSurfaceFocusChanged(bool focused);
     void handleSurfaceVisibilityChanged(bool visible);
     void handleSurfaceStateChanged(Qt::WindowState state);
-    void onSwapBuffersDone();
+    void onSwapBuffersDone(qint64 swapDurationNs);
+    // Rendering thread only
+    int takeSwapIntervalChange();
+    void paceSwapBuffers();
+    QRegion takeSwapDamage();
     void handleScreenPropertiesChange(MirFormFactor formFactor, float scale);
+    // Empty until Mir has replied, windowPropertyChanged("persistentSurfaceId") is emitted then
     QString persistentSurfaceId();
 
+Q_SIGNALS:
+    // Mir has created the window and createdMirWindow() returns it from now on
+    void surfaceRealized();
+
+public Q_SLOTS:
+    // Applies all window changes accumulated since the last flush in a single request to Mir
+    void flushPendingSpec();
+
+private Q_SLOTS:
+    void handleSurfaceRealized();
+    void handlePersistentSurfaceIdReady();
+    void handleFirstFrameSwapped();
+    void applyOcclusionPolicy();
+
 private:
     void updatePanelHeightHack(bool enable);
     void updateSurfaceState();
+    void applyOcclusionPolicyLocked();
+    bool isThrottled() const;
     mutable QMutex mMutex;
     const WId mId;
     Qt::WindowState mWindowState;
@@ -115,6 +181,22 @@ private:
     std::unique_ptr<UbuntuSurface> mSurface;
     float mScale;
     MirFormFactor mFormFactor;
+
+    QAtomicInt mPresentationMode;
+    QAtomicInt mOcclusionPolicy;
+    QAtomicInt mOccluded; // read on the rendering thread
+    bool mInputCompression;
+    QRect mInputGeometry; // GUI thread only
+    QAtomicInt mInputGeometryValid;
+    int mAppliedPresentationMode; // rendering thread only
+    QElapsedTimer mLastSwapTimer; // rendering thread only
+    QMirClientFrameStats mFrameStats;
+    QAtomicInt mUpdateRequested; // since the last swap
+    bool mUpdateWasPending{false}; // when the last swap happened, rendering thread only
+
+    QMutex mSwapDamageMutex;
+    QRegion mSwapDamage; // guarded by mSwapDamageMutex
+    QAtomicInt mHasSwapDamage;
 };
 
 #endif // QMIRCLIENTWINDOW_H
@@ -0,0 +1,180 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientwindowpool.h"
+#include "qmirclientlogging.h"
+
+#include <mir_toolkit/mir_client_library.h>
+
+namespace
+{
+
+const int defaultCapacity = 4;
+
+int poolCapacity()
+{
+    bool ok;
+    const int capacity = qEnvironmentVariableIntValue("QTUBUNTU_WINDOW_POOL_SIZE", &ok);
+    return ok ? qMax(0, capacity) : defaultCapacity;
+}
+
+struct PendingRelease
+{
+    QMirClientWindowPool *pool;
+    QMirClientWindowEventTarget *eventTarget;
+};
+
+} // namespace
+
+QMirClientWindowPool::QMirClientWindowPool(EGLDisplay display)
+    : mEglDisplay(display)
+    , mCapacity(poolCapacity())
+    , mHits(0)
+    , mMisses(0)
+    , mPendingReleases(0)
+{
+    mEntries.reserve(mCapacity);
+}
+
+QMirClientWindowPool::~QMirClientWindowPool()
+{
+    qCDebug(mirclient, "~QMirClientWindowPool - %d hits, %d misses", mHits, mMisses);
+
+    for (const auto &entry : mEntries) {
+        release(entry.window);
+    }
+
+    QMutexLocker lock(&mReleaseMutex);
+    while (mPendingReleases > 0) {
+        mReleaseCondition.wait(&mReleaseMutex);
+    }
+}
+
+bool QMirClientWindowPool::isPoolable(MirWindowType type)
+{
+    return type == mir_window_type_tip || type == mir_window_type_menu;
+}
+
+bool QMirClientWindowPool::take(MirWindow *parent, MirWindowType type, MirPixelFormat pixelFormat,
+                                EGLConfig config, Window *window)
+{
+    // Most recently pooled windows first, their buffers are the most likely to be the right size
+    for (int i = mEntries.count() - 1; i >= 0; --i) {
+        const auto &entry = mEntries.at(i);
+        if (entry.parent == parent && entry.type == type && entry.pixelFormat == pixelFormat
+                && entry.config == config) {
+            *window = entry.window;
+            mEntries.remove(i);
+            ++mHits;
+            qCDebug(mirclient, "Window pool hit (window=%p, %d hits, %d misses)", window->window, mHits, mMisses);
+            return true;
+        }
+    }
+
+    ++mMisses;
+    qCDebug(mirclient, "Window pool miss (%d hits, %d misses)", mHits, mMisses);
+    return false;
+}
+
+void QMirClientWindowPool::put(MirWindow *parent, MirWindowType type, MirPixelFormat pixelFormat,
+                               EGLConfig config, const Window &window)
+{
+    if (mCapacity == 0) {
+        release(window);
+        return;
+    }
+
+    // The owner detached from the event target already, events are dropped until the window is taken again
+    mir_window_set_state(window.window, mir_window_state_hidden);
+
+    if (mEntries.count() == mCapacity) {
+        release(mEntries.first().window);
+        mEntries.removeFirst();
+    }
+    mEntries.append(Entry{parent, type, pixelFormat, config, window});
+}
+
+void QMirClientWindowPool::purgeChildrenOf(MirWindow *parent)
+{
+    for (int i = mEntries.count() - 1; i >= 0; --i) {
+        if (mEntries.at(i).parent == parent) {
+            release(mEntries.at(i).window);
+            mEntries.remove(i);
+        }
+    }
+}
+
+void QMirClientWindowPool::release(const Window &window)
+{
+    deferRelease();
+    releaseDeferred(window);
+}
+
+void QMirClientWindowPool::deferRelease()
+{
+    QMutexLocker lock(&mReleaseMutex);
+    ++mPendingReleases;
+}
+
+void QMirClientWindowPool::releaseDeferred(const Window &window)
+{
+    if (window.eglSurface != EGL_NO_SURFACE) {
+        eglDestroySurface(mEglDisplay, window.eglSurface);
+    }
+
+    // Don't block the GUI thread until the server acknowledges
+    mir_window_release(window.window, windowReleasedCallback, new PendingRelease{this, window.eventTarget});
+}
+
+void QMirClientWindowPool::windowReleasedCallback(MirWindow *window, void *context)
+{
+    Q_UNUSED(window);
+    auto pendingRelease = static_cast<PendingRelease *>(context);
+    auto pool = pendingRelease->pool;
+
+    // No more events can be delivered for the window now
+    delete pendingRelease->eventTarget;
+    delete pendingRelease;
+
+    QMutexLocker lock(&pool->mReleaseMutex);
+    if (--pool->mPendingReleases == 0) {
+        pool->mReleaseCondition.wakeAll();
+    }
+}
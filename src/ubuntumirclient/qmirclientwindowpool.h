@@ -0,0 +1,135 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#ifndef QMIRCLIENTWINDOWPOOL_H
+#define QMIRCLIENTWINDOWPOOL_H
+
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <mir_toolkit/common.h>
+
+#include <EGL/egl.h>
+
+struct MirWindow;
+
+/*
+ * QMirClientWindowEventTarget - the context of a Mir window's event handler. It lives as long
+ * as the Mir window does, so that an event racing the teardown of the surface using the window
+ * finds no surface rather than a freed one.
+ */
+struct QMirClientWindowEventTarget
+{
+    QMutex mutex;
+    void *surface{nullptr}; // guarded by mutex
+};
+
+/*
+ * QMirClientWindowPool - keeps a few hidden tooltip and menu windows, together with their EGL
+ * surfaces, around after their QWindow is gone. Popups come and go at a high rate, and taking
+ * a pooled window and re-parenting and resizing it with a spec is much cheaper than creating
+ * a new Mir window and EGL surface every time.
+ *
+ * Windows leaving the pool, or not fit for it, are released without waiting for the server.
+ * Used from the GUI thread only.
+ */
+class QMirClientWindowPool
+{
+public:
+    struct Window
+    {
+        Window()
+            : window(nullptr), eglSurface(EGL_NO_SURFACE), eventTarget(nullptr) {}
+        Window(MirWindow *window, EGLSurface eglSurface, QMirClientWindowEventTarget *eventTarget,
+               const QString &persistentId)
+            : window(window), eglSurface(eglSurface), eventTarget(eventTarget), persistentId(persistentId) {}
+
+        MirWindow *window;
+        EGLSurface eglSurface;
+        QMirClientWindowEventTarget *eventTarget;
+        QString persistentId;
+    };
+
+    explicit QMirClientWindowPool(EGLDisplay display);
+    ~QMirClientWindowPool();
+
+    static bool isPoolable(MirWindowType type);
+
+    // Hands out a pooled window matching the given properties, if there is one
+    bool take(MirWindow *parent, MirWindowType type, MirPixelFormat pixelFormat, EGLConfig config, Window *window);
+    // Takes ownership of the window, hiding it until it is handed out again
+    void put(MirWindow *parent, MirWindowType type, MirPixelFormat pixelFormat, EGLConfig config, const Window &window);
+    // Releases the pooled windows belonging to a parent which is going away
+    void purgeChildrenOf(MirWindow *parent);
+    // Destroys the EGL surface and releases the window asynchronously, the event target is
+    // deleted once Mir is done with the window
+    void release(const Window &window);
+    // For a window Mir hasn't finished setting up yet, which is then released from one of Mir's
+    // callbacks through releaseDeferred(). The pool waits for it on destruction all the same.
+    void deferRelease();
+    void releaseDeferred(const Window &window);
+
+private:
+    struct Entry
+    {
+        MirWindow *parent;
+        MirWindowType type;
+        MirPixelFormat pixelFormat;
+        EGLConfig config;
+        Window window;
+    };
+
+    static void windowReleasedCallback(MirWindow *window, void *context);
+
+    const EGLDisplay mEglDisplay;
+    const int mCapacity;
+    QVector<Entry> mEntries; // oldest first
+    int mHits;
+    int mMisses;
+
+    // Releases still waiting for the server, which the destructor waits for
+    QMutex mReleaseMutex;
+    QWaitCondition mReleaseCondition;
+    int mPendingReleases;
+};
+
+#endif // QMIRCLIENTWINDOWPOOL_H
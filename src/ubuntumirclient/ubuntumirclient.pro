@@ -16,37 +16,51 @@ PKGCONFIG += egl mirclient ubuntu-platform-api xkbcommon libcontent-hub
 
 SOURCES = \
     qmirclientbackingstore.cpp \
+    qmirclientbackingstorecompositor.cpp \
     qmirclientclipboard.cpp \
     qmirclientcursor.cpp \
     qmirclientdebugextension.cpp \
     qmirclientdesktopwindow.cpp \
+    qmirclienteglconfigcache.cpp \
+    qmirclientframestats.cpp \
     qmirclientglcontext.cpp \
     qmirclientinput.cpp \
+    qmirclientinputshape.cpp \
     qmirclientintegration.cpp \
     qmirclientnativeinterface.cpp \
+    qmirclientoffscreensurface.cpp \
     qmirclientplatformservices.cpp \
     qmirclientplugin.cpp \
+    qmirclientresizecoalescer.cpp \
     qmirclientscreen.cpp \
     qmirclientscreenobserver.cpp \
     qmirclientwindow.cpp \
+    qmirclientwindowpool.cpp \
     qmirclientappstatecontroller.cpp
 
 HEADERS = \
     qmirclientbackingstore.h \
+    qmirclientbackingstorecompositor.h \
     qmirclientclipboard.h \
     qmirclientcursor.h \
     qmirclientdebugextension.h \
     qmirclientdesktopwindow.h \
+    qmirclienteglconfigcache.h \
+    qmirclientframestats.h \
     qmirclientglcontext.h \
     qmirclientinput.h \
+    qmirclientinputshape.h \
     qmirclientintegration.h \
     qmirclientnativeinterface.h \
+    qmirclientoffscreensurface.h \
     qmirclientorientationchangeevent_p.h \
     qmirclientplatformservices.h \
     qmirclientplugin.h \
+    qmirclientresizecoalescer.h \
     qmirclientscreenobserver.h \
     qmirclientscreen.h \
     qmirclientwindow.h \
+    qmirclientwindowpool.h \
     qmirclientlogging.h \
     qmirclientappstatecontroller.h \
     ../shared/ubuntutheme.h
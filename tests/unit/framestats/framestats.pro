@@ -0,0 +1,10 @@
+include(../unit.pri)
+
+TARGET = tst_framestats
+
+SOURCES = \
+    tst_framestats.cpp \
+    $$MIRCLIENT_SRC/qmirclientframestats.cpp
+
+HEADERS = \
+    $$MIRCLIENT_SRC/qmirclientframestats.h
@@ -0,0 +1,229 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientframestats.h"
+
+#include <QtTest>
+
+namespace
+{
+
+const qreal refreshRate = 60;
+const qint64 msNs = 1000000;
+const qint64 periodNs = 1000000000 / 60;
+
+qreal percentile(const QVariantMap &summary, const char *series, const char *which)
+{
+    return summary.value(QLatin1String(series)).toMap().value(QLatin1String(which)).toReal();
+}
+
+quint64 count(const QVariantMap &summary, const char *key)
+{
+    return summary.value(QLatin1String(key)).toULongLong();
+}
+
+// Frames following each other at the refresh rate, after a first one with no interval
+void recordContinuousFrames(QMirClientFrameStats &stats, int frames)
+{
+    for (int i = 0; i < frames; ++i) {
+        stats.recordFrame(2 * msNs, i == 0 ? -1 : periodNs, refreshRate, false, false);
+    }
+}
+
+} // namespace
+
+class tst_FrameStats : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void emptySummary();
+    void percentiles();
+    void keepsMostRecentSamples();
+    void intervalHistogram();
+    void lateFrameWhileRenderingContinuously();
+    void lateFrameWithUpdatePending();
+    void onDemandFramesAreNeverLate();
+    void pacedFramesAreNeverLate();
+    void longPauseIsNotAHitch();
+};
+
+void tst_FrameStats::emptySummary()
+{
+    QMirClientFrameStats stats;
+    const QVariantMap summary = stats.summary();
+
+    QCOMPARE(count(summary, "frameCount"), 0ull);
+    QCOMPARE(summary.value(QStringLiteral("sampleCount")).toInt(), 0);
+    QVERIFY(summary.value(QStringLiteral("swapDuration")).toMap().isEmpty());
+    QVERIFY(summary.value(QStringLiteral("frameInterval")).toMap().isEmpty());
+    for (const QVariant &bucket : summary.value(QStringLiteral("intervalHistogram")).toList()) {
+        QCOMPARE(bucket.toInt(), 0);
+    }
+}
+
+void tst_FrameStats::percentiles()
+{
+    QMirClientFrameStats stats;
+    // Swap durations of 1 to 100 ms, in an order which is neither sorted nor reversed
+    for (int i = 0; i < 100; ++i) {
+        const int ms = 1 + (i * 37) % 100;
+        stats.recordFrame(ms * msNs, i == 0 ? -1 : 10 * msNs, refreshRate, false, false);
+    }
+    const QVariantMap summary = stats.summary();
+
+    QCOMPARE(count(summary, "frameCount"), 100ull);
+    QCOMPARE(summary.value(QStringLiteral("sampleCount")).toInt(), 100);
+    QCOMPARE(percentile(summary, "swapDuration", "p50"), 51.0);
+    QCOMPARE(percentile(summary, "swapDuration", "p90"), 91.0);
+    QCOMPARE(percentile(summary, "swapDuration", "p99"), 100.0);
+    QCOMPARE(percentile(summary, "swapDuration", "max"), 100.0);
+
+    // The first frame has no interval
+    QCOMPARE(percentile(summary, "frameInterval", "p50"), 10.0);
+    QCOMPARE(percentile(summary, "frameInterval", "max"), 10.0);
+}
+
+void tst_FrameStats::keepsMostRecentSamples()
+{
+    QMirClientFrameStats stats;
+    // Swap durations of 0 to 199 ms, of which the newest 128 are kept
+    for (int i = 0; i < 200; ++i) {
+        stats.recordFrame(i * msNs, -1, refreshRate, false, false);
+    }
+    const QVariantMap summary = stats.summary();
+
+    QCOMPARE(count(summary, "frameCount"), 200ull);
+    QCOMPARE(summary.value(QStringLiteral("sampleCount")).toInt(), 128);
+    QCOMPARE(percentile(summary, "swapDuration", "p50"), 136.0);
+    QCOMPARE(percentile(summary, "swapDuration", "max"), 199.0);
+}
+
+void tst_FrameStats::intervalHistogram()
+{
+    QMirClientFrameStats stats;
+    const qint64 intervalsMs[] = { 5, 16, 16, 30, 60, 250 };
+    stats.recordFrame(msNs, -1, refreshRate, false, false);
+    for (qint64 ms : intervalsMs) {
+        stats.recordFrame(msNs, ms * msNs, refreshRate, false, false);
+    }
+    const QVariantMap summary = stats.summary();
+
+    const QVariantList bounds = summary.value(QStringLiteral("intervalHistogramBounds")).toList();
+    const QVariantList histogram = summary.value(QStringLiteral("intervalHistogram")).toList();
+    QCOMPARE(histogram.count(), bounds.count() + 1);
+
+    // Buckets up to 8, 17, 25, 34, 50 and 100 ms, and everything above
+    const int expected[] = { 1, 2, 0, 1, 0, 1, 1 };
+    QCOMPARE(histogram.count(), int(sizeof(expected) / sizeof(expected[0])));
+    for (int i = 0; i < histogram.count(); ++i) {
+        QCOMPARE(histogram.at(i).toInt(), expected[i]);
+    }
+}
+
+void tst_FrameStats::lateFrameWhileRenderingContinuously()
+{
+    QMirClientFrameStats stats;
+    recordContinuousFrames(stats, 10);
+    QCOMPARE(count(stats.summary(), "lateFrames"), 0ull);
+
+    // Three refresh periods: one frame late, and the two periods in between without a frame
+    stats.recordFrame(2 * msNs, 3 * periodNs, refreshRate, false, false);
+    const QVariantMap summary = stats.summary();
+    QCOMPARE(count(summary, "lateFrames"), 1ull);
+    QCOMPARE(count(summary, "droppedFrames"), 2ull);
+}
+
+void tst_FrameStats::lateFrameWithUpdatePending()
+{
+    QMirClientFrameStats stats;
+    stats.recordFrame(2 * msNs, -1, refreshRate, false, false);
+    stats.recordFrame(2 * msNs, 500 * msNs, refreshRate, false, false);
+
+    // Nothing was rendering continuously, but an update was requested before the previous swap
+    stats.recordFrame(2 * msNs, 2 * periodNs, refreshRate, false, true);
+    const QVariantMap summary = stats.summary();
+    QCOMPARE(count(summary, "lateFrames"), 1ull);
+    QCOMPARE(count(summary, "droppedFrames"), 1ull);
+}
+
+void tst_FrameStats::onDemandFramesAreNeverLate()
+{
+    QMirClientFrameStats stats;
+    // A blinking cursor, say
+    stats.recordFrame(2 * msNs, -1, refreshRate, false, false);
+    for (int i = 0; i < 10; ++i) {
+        stats.recordFrame(2 * msNs, 500 * msNs, refreshRate, false, false);
+    }
+    // A single repaint after an idle period
+    stats.recordFrame(2 * msNs, 40 * msNs, refreshRate, false, false);
+
+    const QVariantMap summary = stats.summary();
+    QCOMPARE(count(summary, "lateFrames"), 0ull);
+    QCOMPARE(count(summary, "droppedFrames"), 0ull);
+}
+
+void tst_FrameStats::pacedFramesAreNeverLate()
+{
+    QMirClientFrameStats stats;
+    recordContinuousFrames(stats, 10);
+    // Half rate, or throttled while occluded
+    for (int i = 0; i < 10; ++i) {
+        stats.recordFrame(2 * msNs, 2 * periodNs, refreshRate, true, true);
+    }
+
+    const QVariantMap summary = stats.summary();
+    QCOMPARE(count(summary, "lateFrames"), 0ull);
+    QCOMPARE(count(summary, "droppedFrames"), 0ull);
+}
+
+void tst_FrameStats::longPauseIsNotAHitch()
+{
+    QMirClientFrameStats stats;
+    recordContinuousFrames(stats, 10);
+    // An animation ending, and another one starting a while later
+    stats.recordFrame(2 * msNs, 200 * msNs, refreshRate, false, false);
+
+    QCOMPARE(count(stats.summary(), "lateFrames"), 0ull);
+}
+
+QTEST_APPLESS_MAIN(tst_FrameStats)
+
+#include "tst_framestats.moc"
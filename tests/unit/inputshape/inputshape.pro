@@ -0,0 +1,13 @@
+include(../unit.pri)
+
+TARGET = tst_inputshape
+
+CONFIG += link_pkgconfig
+PKGCONFIG += mirclient
+
+SOURCES = \
+    tst_inputshape.cpp \
+    $$MIRCLIENT_SRC/qmirclientinputshape.cpp
+
+HEADERS = \
+    $$MIRCLIENT_SRC/qmirclientinputshape.h
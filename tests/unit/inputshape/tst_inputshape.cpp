@@ -0,0 +1,222 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientinputshape.h"
+
+#include <QRegion>
+#include <QtTest>
+
+#include <limits>
+
+// Defined by the plugin itself otherwise
+Q_LOGGING_CATEGORY(mirclient, "qt.qpa.mirclient", QtWarningMsg)
+
+namespace
+{
+
+const char budgetVariable[] = "QTUBUNTU_INPUT_SHAPE_MAX_RECTS";
+
+QVector<QRect> shapeRects(const QMirClientInputShape &shape)
+{
+    QVector<QRect> rects;
+    for (int i = 0; i < shape.rectangleCount(); ++i) {
+        const MirRectangle &rect = shape.rectangles()[i];
+        rects.append(QRect(rect.left, rect.top, static_cast<int>(rect.width), static_cast<int>(rect.height)));
+    }
+    return rects;
+}
+
+QRegion covered(const QVector<QRect> &rects)
+{
+    QRegion region;
+    for (const QRect &rect : rects) {
+        region += rect;
+    }
+    return region;
+}
+
+qint64 area(const QRect &rect)
+{
+    return static_cast<qint64>(rect.width()) * rect.height();
+}
+
+// The straightforward quadratic reduction: merge the cheapest pair of neighbours, the first one
+// among equally cheap pairs, until the budget is met
+QVector<QRect> referenceReduction(QVector<QRect> rects, int budget)
+{
+    while (rects.count() > budget) {
+        int cheapest = 0;
+        qint64 cheapestCost = std::numeric_limits<qint64>::max();
+        for (int i = 0; i + 1 < rects.count(); ++i) {
+            const qint64 cost = area(rects.at(i) | rects.at(i + 1)) - area(rects.at(i)) - area(rects.at(i + 1));
+            if (cost < cheapestCost) {
+                cheapest = i;
+                cheapestCost = cost;
+            }
+        }
+        rects[cheapest] |= rects.at(cheapest + 1);
+        rects.remove(cheapest + 1);
+    }
+    return rects;
+}
+
+QRegion checkerboard(int cells, int cellSize)
+{
+    QRegion region;
+    for (int row = 0; row < cells; ++row) {
+        for (int column = row % 2; column < cells; column += 2) {
+            region += QRect(column * cellSize, row * cellSize, cellSize, cellSize);
+        }
+    }
+    return region;
+}
+
+// Overlapping rectangles from a fixed linear congruential sequence, the same on every run
+QRegion scattered(int count)
+{
+    quint32 state = 12345;
+    auto next = [&state](int bound) {
+        state = state * 1103515245u + 12345u;
+        return static_cast<int>((state >> 16) % static_cast<quint32>(bound));
+    };
+
+    QRegion region;
+    for (int i = 0; i < count; ++i) {
+        region += QRect(next(800), next(600), 1 + next(120), 1 + next(90));
+    }
+    return region;
+}
+
+} // namespace
+
+class tst_InputShape : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanup();
+
+    void emptyRegion();
+    void regionWithinBudget();
+    void zeroBudgetIsUnlimited();
+    void reduceToBudget_data();
+    void reduceToBudget();
+    void compileReportsChanges();
+};
+
+void tst_InputShape::cleanup()
+{
+    qunsetenv(budgetVariable);
+}
+
+void tst_InputShape::emptyRegion()
+{
+    QMirClientInputShape shape;
+    QVERIFY(shape.compile(QRegion()));
+    QCOMPARE(shape.rectangleCount(), 0);
+    QVERIFY(shape.rectangles() == nullptr);
+}
+
+void tst_InputShape::regionWithinBudget()
+{
+    const QRegion region = QRegion(0, 0, 10, 10) + QRegion(50, 0, 10, 10) + QRegion(0, 50, 60, 10);
+
+    QMirClientInputShape shape;
+    shape.compile(region);
+    QCOMPARE(shapeRects(shape), region.rects());
+}
+
+void tst_InputShape::zeroBudgetIsUnlimited()
+{
+    qputenv(budgetVariable, "0");
+    const QRegion region = checkerboard(16, 10);
+
+    QMirClientInputShape shape;
+    shape.compile(region);
+    QCOMPARE(shapeRects(shape), region.rects());
+}
+
+void tst_InputShape::reduceToBudget_data()
+{
+    QTest::addColumn<QRegion>("region");
+    QTest::addColumn<int>("budget");
+
+    QTest::newRow("checkerboard, budget 1") << checkerboard(12, 10) << 1;
+    QTest::newRow("checkerboard, budget 7") << checkerboard(12, 10) << 7;
+    QTest::newRow("checkerboard, budget 32") << checkerboard(12, 10) << 32;
+    QTest::newRow("scattered, budget 1") << scattered(200) << 1;
+    QTest::newRow("scattered, budget 16") << scattered(200) << 16;
+    QTest::newRow("scattered, budget 64") << scattered(200) << 64;
+}
+
+void tst_InputShape::reduceToBudget()
+{
+    QFETCH(QRegion, region);
+    QFETCH(int, budget);
+    QVERIFY(region.rectCount() > budget);
+    qputenv(budgetVariable, QByteArray::number(budget));
+
+    QMirClientInputShape shape;
+    shape.compile(region);
+    const QVector<QRect> rects = shapeRects(shape);
+
+    QCOMPARE(rects.count(), budget);
+    // The approximated shape never accepts less input than the mask
+    QVERIFY(region.subtracted(covered(rects)).isEmpty());
+    QCOMPARE(rects, referenceReduction(region.rects(), budget));
+}
+
+void tst_InputShape::compileReportsChanges()
+{
+    const QRegion region = QRegion(0, 0, 10, 10) + QRegion(50, 0, 10, 10);
+
+    QMirClientInputShape shape;
+    QVERIFY(shape.compile(region));
+    QVERIFY(!shape.compile(region));
+    QVERIFY(shape.compile(region.translated(1, 0)));
+    QVERIFY(!shape.compile(region.translated(1, 0)));
+    QVERIFY(shape.compile(QRegion()));
+    QVERIFY(!shape.compile(QRegion()));
+    QVERIFY(shape.compile(region));
+}
+
+QTEST_APPLESS_MAIN(tst_InputShape)
+
+#include "tst_inputshape.moc"
@@ -0,0 +1,10 @@
+include(../unit.pri)
+
+TARGET = tst_resizecoalescer
+
+SOURCES = \
+    tst_resizecoalescer.cpp \
+    $$MIRCLIENT_SRC/qmirclientresizecoalescer.cpp
+
+HEADERS = \
+    $$MIRCLIENT_SRC/qmirclientresizecoalescer.h
@@ -0,0 +1,168 @@
+/****************************************************************************
+**
+** Copyright (C) 2017 Canonical, Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of the plugins of the Qt Toolkit.
+**
+** $QT_BEGIN_LICENSE:LGPL$
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU Lesser General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU Lesser
+** General Public License version 3 as published by the Free Software
+** Foundation and appearing in the file LICENSE.LGPL3 included in the
+** packaging of this file. Please review the following information to
+** ensure the GNU Lesser General Public License version 3 requirements
+** will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 2.0 or (at your option) the GNU General
+** Public license version 3 or any later version approved by the KDE Free
+** Qt Foundation. The licenses are as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL2 and LICENSE.GPL3
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-2.0.html and
+** https://www.gnu.org/licenses/gpl-3.0.html.
+**
+** $QT_END_LICENSE$
+**
+****************************************************************************/
+
+
+#include "qmirclientresizecoalescer.h"
+
+#include <QAtomicInt>
+#include <QThread>
+#include <QtTest>
+
+namespace
+{
+
+// Stands in for the GUI thread: takes the size once for each posted event, and each size taken
+// is one redraw of the window. Returns the number of redraws.
+int handlePostedEvents(QMirClientResizeCoalescer &resizes, int postedEvents, QSize *lastSize)
+{
+    int frames = 0;
+    for (int i = 0; i < postedEvents; ++i) {
+        const QSize size = resizes.take();
+        if (size.isValid()) {
+            ++frames;
+            *lastSize = size;
+        }
+    }
+    return frames;
+}
+
+// Stands in for Mir's event thread, resizing the window to 1x1, 2x2 and so on
+class Resizer : public QThread
+{
+public:
+    Resizer(QMirClientResizeCoalescer *resizes, int count, QAtomicInt *postedEvents)
+        : mResizes(resizes), mCount(count), mPostedEvents(postedEvents) {}
+
+protected:
+    void run() override
+    {
+        for (int i = 1; i <= mCount; ++i) {
+            if (mResizes->offer(i, i)) {
+                mPostedEvents->fetchAndAddOrdered(1);
+            }
+        }
+    }
+
+private:
+    QMirClientResizeCoalescer * const mResizes;
+    const int mCount;
+    QAtomicInt * const mPostedEvents;
+};
+
+} // namespace
+
+class tst_ResizeCoalescer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void nothingToTakeUntilResized();
+    void burstOfResizesCostsOneFrame();
+    void resizeAfterRedrawCostsAnotherFrame();
+    void concurrentResizesEndAtNewestSize();
+};
+
+void tst_ResizeCoalescer::nothingToTakeUntilResized()
+{
+    QMirClientResizeCoalescer resizes;
+    QVERIFY(!resizes.take().isValid());
+}
+
+void tst_ResizeCoalescer::burstOfResizesCostsOneFrame()
+{
+    QMirClientResizeCoalescer resizes;
+    int postedEvents = 0;
+    for (int i = 1; i <= 10; ++i) {
+        if (resizes.offer(100 + i, 200 + i)) {
+            ++postedEvents;
+        }
+    }
+    QCOMPARE(postedEvents, 1);
+
+    QSize size;
+    QCOMPARE(handlePostedEvents(resizes, postedEvents, &size), 1);
+    QCOMPARE(size, QSize(110, 210));
+    QVERIFY(!resizes.take().isValid());
+}
+
+void tst_ResizeCoalescer::resizeAfterRedrawCostsAnotherFrame()
+{
+    QMirClientResizeCoalescer resizes;
+    QSize size;
+
+    QVERIFY(resizes.offer(100, 200));
+    QCOMPARE(handlePostedEvents(resizes, 1, &size), 1);
+    QCOMPARE(size, QSize(100, 200));
+
+    QVERIFY(resizes.offer(300, 400));
+    QVERIFY(!resizes.offer(500, 600));
+    QCOMPARE(handlePostedEvents(resizes, 1, &size), 1);
+    QCOMPARE(size, QSize(500, 600));
+}
+
+void tst_ResizeCoalescer::concurrentResizesEndAtNewestSize()
+{
+    const int resizeCount = 100000;
+    QMirClientResizeCoalescer resizes;
+    QAtomicInt postedEvents(0);
+    Resizer resizer(&resizes, resizeCount, &postedEvents);
+
+    int handledEvents = 0;
+    int frames = 0;
+    QSize size;
+    resizer.start();
+    while (!resizer.isFinished() || handledEvents < postedEvents.loadAcquire()) {
+        if (handledEvents < postedEvents.loadAcquire()) {
+            frames += handlePostedEvents(resizes, 1, &size);
+            ++handledEvents;
+        } else {
+            QThread::yieldCurrentThread();
+        }
+    }
+    QVERIFY(resizer.wait());
+
+    // Every posted event redraws once, and the last redraw is at the final size
+    QCOMPARE(frames, handledEvents);
+    QVERIFY(frames <= resizeCount);
+    QCOMPARE(size, QSize(resizeCount, resizeCount));
+}
+
+QTEST_APPLESS_MAIN(tst_ResizeCoalescer)
+
+#include "tst_resizecoalescer.moc"
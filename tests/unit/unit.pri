@@ -0,0 +1,11 @@
+# Unit tests of the parts of the ubuntumirclient plugin which don't need a Mir server.
+# Run them with "make check".
+
+QT += testlib
+CONFIG += testcase no_keywords
+
+QMAKE_CXXFLAGS += -std=c++11 -Werror -Wall
+QMAKE_LFLAGS += -std=c++11
+
+MIRCLIENT_SRC = $$PWD/../../src/ubuntumirclient
+INCLUDEPATH += $$MIRCLIENT_SRC